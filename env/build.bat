@@ -23,6 +23,10 @@ pushd ".\build"
 del *.pdb > NUL 2> NUL
 set source_list="%code_root%\sim8086.cpp"
 cl %common_compiler_flags% %source_list% /link %common_linker_flags%
+cl %common_compiler_flags% -DSIM86_PROFILER=1 -Fesim8086_profiled.exe -Fosim8086_profiled.obj -Fasim8086_profiled.cod %source_list% /link %common_linker_flags%
+
+cl %common_compiler_flags% "%code_root%\workload_generator.cpp" /link %common_linker_flags%
+cl %common_compiler_flags% "%code_root%\decoder_sweep.cpp" /link %common_linker_flags%
 
 popd REM .\build
 popd REM .\part1
@@ -0,0 +1,416 @@
+// decoder_sweep.cpp
+//
+// Exhaustive decoder sweep. Every opcode byte is paired with every second
+// (modrm) byte, and the bytes after them take a few values so that positive,
+// negative and zero displacements and immediates all show up. The opcode and
+// modrm bytes already select the displacement/immediate length, so this covers
+// every length class the decoder has. Each encoding goes through
+// execute_instruction, the same path main() uses, and is timed on its own.
+//
+// Opcodes are handed out to one thread per core, each thread runs its own copy
+// of the machine (SIM86_STATE is thread_local here). An assert does not stop the
+// sweep: it jumps back to the encoding that caused it, and is reported with the
+// encodings that hit the unknown branches.
+
+#define SIM86_NO_MAIN 1
+#define SIM86_STATE   static thread_local
+#define assert(x) if (!(x)) { sweep_assert_failed(__FILE__, __LINE__); }
+
+#include <setjmp.h>
+
+void sweep_assert_failed(char *file, int line);
+
+#include "sim8086.cpp"
+
+#define SWEEP_ENCODING_SIZE 6     // opcode, modrm, disp16, imm16: the longest encoding decoded
+#define MAX_ASSERT_SITES    4     // per opcode
+#define MAX_SWEEP_THREADS   64
+
+// what follows the modrm byte, repeated up to SWEEP_ENCODING_SIZE
+static u8 trailing_patterns[] = { 0x00, 0x01, 0x7F, 0x80, 0xFF };
+
+// =========================================
+// Results
+//
+// decoded encodings are bucketed by instruction class, operand form and
+// displacement/immediate length
+#define SWEEP_BUCKET(class_index, has_memory_operand, disp, imm) ((((class_index)*2 + (has_memory_operand))*3 + (disp))*3 + (imm))
+#define SWEEP_BUCKET_COUNT SWEEP_BUCKET(INSTRUCTION_CLASS_COUNT, 0, 0, 0)
+
+struct Sweep_Bucket {
+    u64 encodings;
+    u64 bytes;
+    u64 cycles;    // sum of the fastest repetition of each encoding
+};
+
+struct Assert_Site {
+    char *file;
+    s32   line;
+    u32   count;
+    u8    example[SWEEP_ENCODING_SIZE];
+};
+
+struct Opcode_Result {
+    u32 decoded;
+    u32 unknown;     // unknown opcode
+    u32 unknown_op;  // known opcode group, unsupported operation
+    u32 asserted;
+
+    char *unknown_op_group;
+    u8    unknown_op_example[SWEEP_ENCODING_SIZE];
+
+    Assert_Site asserts[MAX_ASSERT_SITES];
+    u32         assert_site_count;
+    u32         other_asserts;  // past MAX_ASSERT_SITES
+};
+
+struct Sweep_Thread {
+    HANDLE       handle;
+    u64          decodes;
+    Sweep_Bucket buckets[SWEEP_BUCKET_COUNT];
+};
+
+static Opcode_Result  opcode_results[256];  // each opcode is swept by a single thread
+static Sweep_Thread   sweep_threads[MAX_SWEEP_THREADS];
+static volatile LONG  next_opcode;
+static u32            sweep_repetitions = 8;
+static bool           sweep_decode_only;
+
+static thread_local jmp_buf *sweep_jump;
+static thread_local char    *sweep_assert_file;
+static thread_local s32      sweep_assert_line;
+
+void sweep_assert_failed(char *file, int line) {
+    sweep_assert_file = file;
+    sweep_assert_line = line;
+    longjmp(*sweep_jump, 1);
+}
+
+
+// =========================================
+// Sweep
+//
+// nothing in here needs destructors, longjmp only skips plain data
+#pragma warning(push)
+#pragma warning(disable: 4611) // interaction between '_setjmp' and C++ object destruction is non-portable
+
+// returns: false if an assert fired
+bool sweep_decode(u8 *encoding, Trace_Event *event, u64 *cycles) {
+    memset(registers, 0, sizeof(registers));
+    flags_register      = 0;
+    instruction_start   = encoding;
+    instruction_end     = encoding + SWEEP_ENCODING_SIZE;
+    instruction_pointer = encoding;
+    decode_only         = sweep_decode_only;
+
+    jmp_buf jump;
+    sweep_jump = &jump;
+    if (setjmp(jump))
+        return false;
+
+    *event = {};
+    u64 start_time = read_cpu_timer();
+    execute_instruction(event);
+    *cycles = read_cpu_timer() - start_time;
+
+    return true;
+}
+
+#pragma warning(pop)
+
+Sweep_Bucket *bucket_for(Sweep_Thread *thread, Trace_Event *event) {
+    auto class_index = instruction_class(event->instruction, event->transfer != TRANSFER_NONE);
+    u8   mod         = instruction_start[1] >> 6;
+
+    bool uses_modrm = (class_index == CLASS_MOV_REG_RM) || (class_index == CLASS_ALU_REG_RM) ||
+                      (class_index == CLASS_MOV_IMMEDIATE_RM) || (class_index == CLASS_ALU_IMMEDIATE_RM) ||
+                      (event->instruction == 0x8F) || (event->instruction == 0xFF);
+
+    u32 has_memory_operand = 0;
+    u32 disp               = 0;
+    Trace_Operand *operands[] = { &event->dest, &event->source };
+    for (u32 it = 0; it < arr_len(operands); it += 1) {
+        auto operand = operands[it];
+        if (operand->kind == OPERAND_MEMORY) {
+            has_memory_operand = 1;
+            if (operand->memory_pointer.has_displacement)
+                disp = (mod == 0b01) ? 1 : 2;
+        }
+        else if (operand->kind == OPERAND_DIRECT_ADDRESS) {
+            has_memory_operand = 1;
+            disp               = 2;
+        }
+    }
+
+    s32 imm = (s32)event->size - 1 - (uses_modrm ? 1 : 0) - (s32)disp;
+    if (imm < 0)  imm = 0;
+    if (imm > 2)  imm = 2;
+
+    return &thread->buckets[SWEEP_BUCKET(class_index, has_memory_operand, disp, imm)];
+}
+
+void record_assert(Opcode_Result *result, u8 *encoding) {
+    result->asserted += 1;
+
+    for (u32 it = 0; it < result->assert_site_count; it += 1) {
+        auto site = &result->asserts[it];
+        if ((site->line == sweep_assert_line) && (strcmp(site->file, sweep_assert_file) == 0)) {
+            site->count += 1;
+            return;
+        }
+    }
+
+    if (result->assert_site_count == MAX_ASSERT_SITES) {
+        result->other_asserts += 1;
+        return;
+    }
+
+    auto site = &result->asserts[result->assert_site_count];
+    result->assert_site_count += 1;
+    site->file  = sweep_assert_file;
+    site->line  = sweep_assert_line;
+    site->count = 1;
+    memcpy(site->example, encoding, SWEEP_ENCODING_SIZE);
+}
+
+void sweep_opcode(Sweep_Thread *thread, u8 opcode) {
+    auto result = &opcode_results[opcode];
+
+    u8 encoding[SWEEP_ENCODING_SIZE];
+    encoding[0] = opcode;
+    for (u32 modrm = 0; modrm < 256; modrm += 1) {
+        encoding[1] = (u8)modrm;
+
+        for (u32 pattern = 0; pattern < arr_len(trailing_patterns); pattern += 1) {
+            memset(encoding + 2, trailing_patterns[pattern], SWEEP_ENCODING_SIZE - 2);
+
+            // the fastest repetition is the one that did not get interrupted
+            Trace_Event event    = {};
+            u64         best     = ~0ull;
+            bool        asserted = false;
+            for (u32 repetition = 0; repetition < sweep_repetitions; repetition += 1) {
+                u64 cycles = 0;
+                if (!sweep_decode(encoding, &event, &cycles)) {
+                    asserted = true;
+                    break;
+                }
+                if (cycles < best)  best = cycles;
+                thread->decodes += 1;
+            }
+
+            if (asserted) {
+                record_assert(result, encoding);
+            }
+            else if (event.kind == TRACE_UNKNOWN) {
+                result->unknown += 1;
+            }
+            else if (event.kind == TRACE_UNKNOWN_OP) {
+                if (!result->unknown_op) {
+                    result->unknown_op_group = event.text;
+                    memcpy(result->unknown_op_example, encoding, SWEEP_ENCODING_SIZE);
+                }
+                result->unknown_op += 1;
+            }
+            else {
+                result->decoded += 1;
+
+                auto bucket = bucket_for(thread, &event);
+                bucket->encodings += 1;
+                bucket->bytes     += event.size;
+                bucket->cycles    += best;
+            }
+        }
+    }
+}
+
+DWORD WINAPI sweep_thread_proc(LPVOID parameter) {
+    auto thread = (Sweep_Thread *)parameter;
+    for (;;) {
+        LONG opcode = InterlockedIncrement(&next_opcode) - 1;
+        if (opcode > 0xFF)  break;
+        sweep_opcode(thread, (u8)opcode);
+    }
+    return 0;
+}
+
+
+// =========================================
+// Report
+//
+char *file_name_only(char *path) {
+    char *result = path;
+    for (char *it = path; *it; it += 1) {
+        if ((*it == '/') || (*it == '\\'))  result = it + 1;
+    }
+    return result;
+}
+
+void print_encoding(u8 *encoding) {
+    for (u32 it = 0; it < SWEEP_ENCODING_SIZE; it += 1)
+        printf(" %02x", encoding[it]);
+}
+
+void report_sweep(u32 thread_count, u64 wall_time, u64 cpu_frequency) {
+    Sweep_Bucket buckets[SWEEP_BUCKET_COUNT] = {};
+    u64 decodes = 0;
+    for (u32 it = 0; it < thread_count; it += 1) {
+        decodes += sweep_threads[it].decodes;
+        for (u32 bucket = 0; bucket < SWEEP_BUCKET_COUNT; bucket += 1) {
+            buckets[bucket].encodings += sweep_threads[it].buckets[bucket].encodings;
+            buckets[bucket].bytes     += sweep_threads[it].buckets[bucket].bytes;
+            buckets[bucket].cycles    += sweep_threads[it].buckets[bucket].cycles;
+        }
+    }
+
+    Opcode_Result total = {};
+    u32 full_opcodes = 0;
+    u32 none_opcodes = 0;
+    for (u32 it = 0; it < 256; it += 1) {
+        auto result = &opcode_results[it];
+        total.decoded    += result->decoded;
+        total.unknown    += result->unknown;
+        total.unknown_op += result->unknown_op;
+        total.asserted   += result->asserted;
+        if (!result->unknown && !result->unknown_op && !result->asserted)  full_opcodes += 1;
+        if (!result->decoded)                                               none_opcodes += 1;
+    }
+
+    u32 encoding_count = total.decoded + total.unknown + total.unknown_op + total.asserted;
+    f64 seconds        = (f64)wall_time / (f64)os_timer_frequency();
+
+    printf("; Decoder sweep (%s): %u encodings (256 opcodes x 256 modrm x %u trailing patterns), %u repetitions, %u threads\n",
+           sweep_decode_only ? "decode only" : "decode and execute",
+           encoding_count, (u32)arr_len(trailing_patterns), sweep_repetitions, thread_count);
+    printf(";   decoded %u, unknown opcode %u, unknown op %u, asserts %u\n",
+           total.decoded, total.unknown, total.unknown_op, total.asserted);
+    printf(";   opcodes: %u always decode, %u never decode\n", full_opcodes, none_opcodes);
+    printf(";   wall time %.2fms, %llu decodes (%.2f Mdecodes/s over all threads)\n",
+           1000.0 * seconds, decodes, seconds ? (f64)decodes / seconds / 1000000.0 : 0.0);
+    if (cpu_frequency)
+        printf(";   cpu frequency ~%llu MHz\n", cpu_frequency / 1000000);
+
+    printf(";\n;   class         operand  disp  imm   encodings  cycles/decode  Mdecodes/s  MB/s\n");
+    for (u32 class_index = 0; class_index < INSTRUCTION_CLASS_COUNT; class_index += 1) {
+        for (u32 has_memory_operand = 0; has_memory_operand < 2; has_memory_operand += 1) {
+            for (u32 disp = 0; disp < 3; disp += 1) {
+                for (u32 imm = 0; imm < 3; imm += 1) {
+                    auto bucket = &buckets[SWEEP_BUCKET(class_index, has_memory_operand, disp, imm)];
+                    if (!bucket->encodings)  continue;
+
+                    f64 cycles = (f64)bucket->cycles / (f64)bucket->encodings;
+                    printf(";   %-12s  %-7s  %4u  %3u  %10llu  %13.1f",
+                           instruction_class_names[class_index], has_memory_operand ? "mem" : "reg", disp, imm, bucket->encodings, cycles);
+                    if (cpu_frequency && bucket->cycles) {
+                        f64 bucket_seconds = (f64)bucket->cycles / (f64)cpu_frequency;
+                        printf("  %10.2f  %4.0f", (f64)bucket->encodings / bucket_seconds / 1000000.0,
+                               (f64)bucket->bytes / bucket_seconds / 1000000.0);
+                    }
+                    printf("\n");
+                }
+            }
+        }
+    }
+
+    // opcodes the decoder does not know at all go on one line
+    printf(";\n;   unknown opcodes:");
+    u32 unknown_count = 0;
+    for (u32 it = 0; it < 256; it += 1) {
+        if (opcode_results[it].unknown != encoding_count / 256)  continue;
+        if (unknown_count && !(unknown_count % 24))  printf("\n;                   ");
+        printf(" %02x", it);
+        unknown_count += 1;
+    }
+    printf("\n");
+
+    printf(";\n;   other opcodes with encodings that did not decode:\n");
+    for (u32 it = 0; it < 256; it += 1) {
+        auto result = &opcode_results[it];
+        if (result->unknown == encoding_count / 256)                        continue;
+        if (!result->unknown && !result->unknown_op && !result->asserted)  continue;
+
+        printf(";   0x%02x  decoded %4u", it, result->decoded);
+        if (result->unknown)
+            printf(", unknown %u", result->unknown);
+        if (result->unknown_op) {
+            printf(", unknown op %u (%s, e.g.", result->unknown_op, result->unknown_op_group);
+            print_encoding(result->unknown_op_example);
+            printf(")");
+        }
+        printf("\n");
+
+        for (u32 site_index = 0; site_index < result->assert_site_count; site_index += 1) {
+            auto site = &result->asserts[site_index];
+            printf(";          assert %s:%d hit %u times, e.g.", file_name_only(site->file), site->line, site->count);
+            print_encoding(site->example);
+            printf("\n");
+        }
+        if (result->other_asserts)
+            printf(";          %u more asserts at other places\n", result->other_asserts);
+    }
+}
+
+
+// =========================================
+// Main
+//
+void print_usage(char *exe) {
+    printf("Usage: %s [options]\n", exe);
+    printf("    -threads <n>   worker threads, up to %d            (default: one per core)\n", MAX_SWEEP_THREADS);
+    printf("    -repeat  <n>   decodes per encoding, the fastest is kept  (default 8)\n");
+    printf("    -decode        decode only, like -cfg: nothing executes\n");
+}
+
+int main(int args_count, char *args[])
+{
+    SYSTEM_INFO system_info = {};
+    GetSystemInfo(&system_info);
+    u32 thread_count = system_info.dwNumberOfProcessors;
+
+    for (int it = 1; it < args_count; it += 1) {
+        char *arg = args[it];
+        if (strcmp(arg, "-decode") == 0) {
+            sweep_decode_only = true;
+        }
+        else if ((strcmp(arg, "-threads") == 0) && (it + 1 < args_count)) {
+            thread_count = (u32)strtoul(args[it + 1], 0, 0);
+            it += 1;
+        }
+        else if ((strcmp(arg, "-repeat") == 0) && (it + 1 < args_count)) {
+            sweep_repetitions = (u32)strtoul(args[it + 1], 0, 0);
+            it += 1;
+        }
+        else {
+            print_usage(args[0]);
+            return 1;
+        }
+    }
+
+    if (thread_count < 1)                  thread_count = 1;
+    if (thread_count > MAX_SWEEP_THREADS)  thread_count = MAX_SWEEP_THREADS;
+    if (sweep_repetitions < 1)             sweep_repetitions = 1;
+
+    u64 cpu_frequency = estimate_cpu_frequency(100);
+
+    u64 start_time = read_os_timer();
+    for (u32 it = 0; it < thread_count; it += 1) {
+        sweep_threads[it].handle = CreateThread(0, 0, sweep_thread_proc, &sweep_threads[it], 0, 0);
+        if (!sweep_threads[it].handle) {
+            thread_count = it;
+            break;
+        }
+    }
+    // no thread could start, the main thread sweeps everything
+    if (!thread_count) {
+        thread_count = 1;
+        sweep_thread_proc(&sweep_threads[0]);
+    }
+    for (u32 it = 0; it < thread_count; it += 1) {
+        if (!sweep_threads[it].handle)  continue;
+        WaitForSingleObject(sweep_threads[it].handle, INFINITE);
+        CloseHandle(sweep_threads[it].handle);
+    }
+    u64 wall_time = read_os_timer() - start_time;
+
+    report_sweep(thread_count, wall_time, cpu_frequency);
+    return 0;
+}
@@ -6,11 +6,20 @@
 #include <stdlib.h>
 #include <cstring>
 
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <intrin.h>
+
+// tools that include this file can bring their own assert, see decoder_sweep.cpp
+#ifndef assert
 #if SIM86_DEBUG
 #define assert(x) if (!(x)) { __debugbreak(); }
 #else
 #define assert(x)
 #endif
+#endif
+
+#include "sim8086_profiler.cpp"
 
 void print_binary(u16 n)
 {
@@ -122,6 +131,7 @@ struct Memory_Pointer {
     Register_Pointer *addend_1;
     s16               address;
     u16               num_bytes;
+    bool              has_displacement;
 };
 
 
@@ -156,6 +166,33 @@ void fill_flags_string(u16 flags, char out_str[]) {
     *out_str = 0;
 }
 
+// bit of each flag in the 8086 FLAGS word, what pushf and popf move through the stack
+static u8 flag_bits_8086[] = {
+    0,  // CF
+    2,  // PF
+    4,  // AF
+    6,  // ZF
+    7,  // SF
+    8,  // TF
+    9,  // IF
+    10, // DF
+    11, // OF
+};
+
+u16 flags_to_8086(u16 flags) {
+    u16 result = 0;
+    for (int it = 0; it < FLAGS_COUNT; it += 1)
+        result |= ((flags >> it) & 1) << flag_bits_8086[it];
+    return result;
+}
+
+u16 flags_from_8086(u16 flags_word) {
+    u16 result = 0;
+    for (int it = 0; it < FLAGS_COUNT; it += 1)
+        result |= ((flags_word >> flag_bits_8086[it]) & 1) << it;
+    return result;
+}
+
 int first_bit_set_high(u64 value) {
     int bit_index = 0;
 
@@ -169,22 +206,30 @@ int first_bit_set_high(u64 value) {
 // =========================================
 // State variables
 //
-#define MEMORY_SIZE 0xFFFF
-static u8  memory[MEMORY_SIZE];
-static u8 *instruction_pointer;
-static u8 *instruction_start;
-static u8 *instruction_end;
-static u16 registers[REGISTER_COUNT];
-static u16 flags_register;
+// SIM86_STATE: storage of the machine state, decoder_sweep.cpp makes it thread_local
+#ifndef SIM86_STATE
+#define SIM86_STATE static
+#endif
+
+#define MEMORY_SIZE (0x10000 + 1) // a word access at 0xFFFF stays in bounds
+SIM86_STATE u8  memory[MEMORY_SIZE];
+SIM86_STATE u8 *instruction_pointer;
+SIM86_STATE u8 *instruction_start;
+SIM86_STATE u8 *instruction_end;
+SIM86_STATE u16 registers[REGISTER_COUNT];
+SIM86_STATE u16 flags_register;
+SIM86_STATE bool decode_only; // static analysis: handlers decode and describe, nothing executes
 
 u16 calc_effective_address(Memory_Pointer *memptr) {
+    time_block("ea calc");
+
     u64 mem_address = memptr->address;
     if (memptr->addend_0)
         mem_address += registers[memptr->addend_0->index];
     if (memptr->addend_1)
         mem_address += registers[memptr->addend_1->index];
 
-    assert(mem_address <= 0xFFFF);
+    assert(decode_only || mem_address <= 0xFFFF);
     return (u16)mem_address;
 };
 
@@ -218,25 +263,11 @@ u8 peek_byte()
     return *instruction_pointer;
 };
 
-void print_op(Decoded_Op op, char *dest_str, u16 curr_data, u16 prev_data, bool print_flags = false, u16 prev_flags = 0) {
-    assert(dest_str);
-
-    printf("\t; %s:0x%04x -> 0x%04x", dest_str, prev_data, curr_data);
-
-    printf("\tip:0x%x", registers[ip]);
-
-    if (print_flags) {
-        char curr_flags_str[FLAGS_COUNT + 1] = {};
-        char prev_flags_str[FLAGS_COUNT + 1] = {};
-
-        fill_flags_string(flags_register, curr_flags_str);
-        fill_flags_string(    prev_flags, prev_flags_str);
-        printf("\tflags: %s -> %s", prev_flags_str, curr_flags_str);
-    }
-}
-
 // returns: true if flags were edited
 bool exec_op(Decoded_Op op, u16 *dest, u16 dest_shift, u16 dest_mask, u16 data) {
+    if (decode_only)  return op != OP_MOV;
+    time_block("exec");
+
     u16 prev_register_data = *dest;
 
     u16 result = ((*dest) >> dest_shift) & dest_mask;
@@ -261,6 +292,7 @@ bool exec_op(Decoded_Op op, u16 *dest, u16 dest_shift, u16 dest_mask, u16 data)
     }
 
     if (do_flags) {
+        time_block("flag update");
         auto high_bit = first_bit_set_high(dest_mask);
 
         flags_register &= (~(1 << ZF)) & (~(1 << SF));
@@ -294,6 +326,28 @@ inline bool exec_op(Decoded_Op op, Memory_Pointer *dest_mem_ptr, u16 data) {
 }
 
 
+// =========================================
+// Stack
+//
+// sp wraps around the 64k like the 8086 stack segment does, the first push
+// from sp = 0 lands at 0xFFFE
+
+inline void push_word(u16 data) {
+    registers[sp] -= 2;
+
+    u16 address = registers[sp];
+    memory[address]            = (u8)(data);
+    memory[(u16)(address + 1)] = (u8)(data >> 8);
+}
+
+inline u16 pop_word() {
+    u16 address = registers[sp];
+    u16 data    = memory[address] | (memory[(u16)(address + 1)] << 8);
+    registers[sp] += 2;
+    return data;
+}
+
+
 
 Memory_Pointer memory_pointer_table[] = {
 #define rpt register_pointer_table
@@ -349,10 +403,12 @@ Mod_R_M_Result do_mod_r_m(u8 mod, u8 r_m, u8 w)
 
         if (mod == 0b01)
         {
+            mem_pointer->has_displacement = true;
             mem_pointer->address = (s8)eat_byte();
         }
         else if ((mod == 0b10) || (r_m == 0b110))
         {
+            mem_pointer->has_displacement = true;
             mem_pointer->address  =  eat_byte();
             mem_pointer->address |= (eat_byte() << 8);
         }
@@ -396,8 +452,12 @@ Memory_Pointer_String to_string(Memory_Pointer *memptr) {
     return result;
 }
 
+#include "sim8086_trace.cpp"
+#include "sim8086_timing.cpp"
+#include "sim8086_callgraph.cpp"
+
 // will advance instruction pointer by calling eat_byte when necessary
-void do_d_w_mod_reg_rm(u8 instruction, Decoded_Op op)
+void do_d_w_mod_reg_rm(u8 instruction, Decoded_Op op, Trace_Event *event)
 {
     char *op_str = op_names[op];
 
@@ -419,36 +479,38 @@ void do_d_w_mod_reg_rm(u8 instruction, Decoded_Op op)
     u16   prev_dest     = 0;
     u16   prev_flags    = flags_register;
     u16   curr_data     = 0;
-    char *dest_name_str = 0;
     bool flags_edited = false;
+
+    event->text = op_str;
     if (!r_m_result.is_memory) {
         auto   dest_reg_ptr = d_flag ? &register_pointer_table[reg] :  r_m_result.register_pointer;
         auto source_reg_ptr = d_flag ?  r_m_result.register_pointer : &register_pointer_table[reg];
 
-        printf("%s %s, %s", op_str, dest_reg_ptr->name, source_reg_ptr->name);
+        event->dest   = trace_register(dest_reg_ptr);
+        event->source = trace_register(source_reg_ptr);
 
         // exec
         prev_dest    = registers[dest_reg_ptr->index];
         flags_edited = exec_op(op, dest_reg_ptr, source_reg_ptr);
 
-        dest_name_str = dest_reg_ptr->name;
         curr_data     = registers[dest_reg_ptr->index];
+        trace_effect(event, SUFFIX_NONE, curr_data, prev_dest, flags_edited, prev_flags);
     } else {
         auto reg_ptr = &register_pointer_table[reg];
 
         u16 mem_data = read_memory(&r_m_result.memory_pointer);
 
-        auto mem_string = to_string(&r_m_result.memory_pointer);
         if (d_flag) {
-            printf("%s %s, %s", op_str, reg_ptr->name, mem_string.data);
+            event->dest   = trace_register(reg_ptr);
+            event->source = trace_memory(&r_m_result.memory_pointer);
 
             prev_dest    = registers[reg_ptr->index];
             flags_edited = exec_op(op, reg_ptr, mem_data);
 
-            dest_name_str = reg_ptr->name;
             curr_data     = registers[reg_ptr->index];
         } else {
-            printf("%s %s, %s", op_str, mem_string.data, reg_ptr->name);
+            event->dest   = trace_memory(&r_m_result.memory_pointer);
+            event->source = trace_register(reg_ptr);
 
             u16 data = registers[reg_ptr->index] & reg_ptr->mask;
             data >>= reg_ptr->shift;
@@ -456,13 +518,11 @@ void do_d_w_mod_reg_rm(u8 instruction, Decoded_Op op)
             prev_dest    = mem_data;
             flags_edited = exec_op(op, &r_m_result.memory_pointer, data);
 
-            dest_name_str = mem_string.data;
             curr_data     = read_memory(&r_m_result.memory_pointer);
         }
 
-        print_op(op, dest_name_str, curr_data, prev_dest, flags_edited, prev_flags);
+        trace_effect(event, SUFFIX_OP, curr_data, prev_dest, flags_edited, prev_flags);
     }
-    printf("\n");
 }
 
 // will advance instruction pointer by calling eat_byte when necessary
@@ -470,57 +530,88 @@ void do_s_w_mod_rm_disp_data(u8 instruction, char *op, bool print_size)
 {
 }
 
-int main(int args_count, char *args[])
+void execute_instruction(Trace_Event *event);
+#include "sim8086_cfg.cpp"
+#include "sim8086_wide.cpp"
+
+// decodes and executes the instruction at instruction_pointer, describing it in event
+void execute_instruction(Trace_Event *event)
 {
-    if (args_count == 1) return 0;
+    time_block("decode");
+    event->address = registers[ip];
 
-    FILE *in_file = 0;
-    if (fopen_s(&in_file, args[1], "rb"))
+    u8 instruction = eat_byte();
+    event->instruction = instruction;
+
+    if ((instruction >> 2) == 0b100010)     // mov register/memory to/from register
     {
-        printf("ERROR: File '%s' could not be opened.\n", args[1]);
-        return 1;
+        do_d_w_mod_reg_rm(instruction, OP_MOV, event);
     }
+    else if (((instruction >> 2) & 0b110001) == 0)
+    {
+        // 0b000000 == add  reg/memory with register to either
+        // 0b001010 == sub  reg/memory and register to either
+        // 0b001110 == cmp  register/memory and register
+        u8   op_code = (instruction >> 3) & 0b111;
+        auto op      = decode_op(op_code);
+
+        if (op < OP_UNKNOWN)
+            do_d_w_mod_reg_rm(instruction, op, event);
+        else
+        {
+            event->kind = TRACE_UNKNOWN_OP;
+            event->text = "register/memory to/from register";
+        }
+    }
+
+    else if ((instruction >> 1) == 0b1100011) // mov immediate to register/memory
+    {
+        u8 w          = (instruction & 1);
 
+        u8 mov_extra0 = eat_byte();
 
-    fseek(in_file, 0, SEEK_END);
-    s64 size = ftell(in_file);
-    fseek(in_file, 0, SEEK_SET);
+        u8 mod = mov_extra0 >> 6;
+        u8 r_m = mov_extra0 & 0b111;
 
-    instruction_start  = (u8  *)malloc(size * sizeof(u8));
-    instruction_end    = instruction_start + size;
-    fread(instruction_start, sizeof(u8), size, in_file);
-    fclose(in_file);
+        Mod_R_M_Result r_m_result = do_mod_r_m(mod, r_m, w);
 
-    instruction_pointer = instruction_start;
+        u16 data = eat_byte();
+        if (w)
+            data = data | (eat_byte() << 8);
 
-    printf("bits 16\n\n");
-    while (instruction_pointer < instruction_end) {
-        u8 instruction = eat_byte();
-        if ((instruction >> 2) == 0b100010)     // mov register/memory to/from register
-        {
-            do_d_w_mod_reg_rm(instruction, OP_MOV);
+        event->text   = "mov";
+        event->source = trace_immediate(OPERAND_IMMEDIATE, data);
+        if (r_m_result.is_memory) {
+            event->dest = trace_memory(&r_m_result.memory_pointer);
+
+            u16 prev_dest     = read_memory(&r_m_result.memory_pointer);
+           exec_op(OP_MOV, &r_m_result.memory_pointer, data);
+
+            trace_effect(event, SUFFIX_OP, read_memory(&r_m_result.memory_pointer), prev_dest, false);
+        } else {
+            event->dest = trace_register(r_m_result.register_pointer);
+
+            u16 prev_dest = registers[r_m_result.register_pointer->index];
+            exec_op(OP_MOV, r_m_result.register_pointer, data);
+
+            trace_effect(event, SUFFIX_OP, registers[r_m_result.register_pointer->index], prev_dest, false);
         }
-        else if (((instruction >> 2) & 0b110001) == 0)
+    }
+    else if ((instruction >> 2) == 0b100000)
+    {
+        u8   op_code = (peek_byte() >> 3) & 0b111;
+        auto op      = decode_op(op_code);
+        auto op_str  = op_names[op];
+
+        if (op == OP_UNKNOWN)
         {
-            // 0b000000 == add  reg/memory with register to either
-            // 0b001010 == sub  reg/memory and register to either
-            // 0b001110 == cmp  register/memory and register
-            u8   op_code = (instruction >> 3) & 0b111;
-            auto op      = decode_op(op_code);
-
-            if (op < OP_UNKNOWN)
-                do_d_w_mod_reg_rm(instruction, op);
-            else
-            {
-                printf("unknown op: register/memory to/from register   --> ");
-                print_binary(instruction);
-                printf("\n");
-            }
+            event->kind = TRACE_UNKNOWN_OP;
+            event->text = "register/memory to register";
         }
-
-        else if ((instruction >> 1) == 0b1100011) // mov immediate to register/memory
+        else
         {
-            u8 w          = (instruction & 1);
+            u8 w          = (instruction     ) & 1;
+            u8 s          = (instruction >> 1) & 1;
 
             u8 mov_extra0 = eat_byte();
 
@@ -529,281 +620,523 @@ int main(int args_count, char *args[])
 
             Mod_R_M_Result r_m_result = do_mod_r_m(mod, r_m, w);
 
-            u16 data = eat_byte();
-            if (w)
+            s16 data;
+            if (!s && w)
+            {
+                data = eat_byte();
                 data = data | (eat_byte() << 8);
+            }
+            else
+                data = (s8)eat_byte();
 
-            if (r_m_result.is_memory) {
-                auto mem_string = to_string(&r_m_result.memory_pointer);
-                printf("mov %s, %d", mem_string.data, data);
+            event->text   = op_str;
+            event->source = trace_immediate(s ? OPERAND_IMMEDIATE : OPERAND_IMMEDIATE_UNSIGNED, data);
 
-                u16 prev_dest     = read_memory(&r_m_result.memory_pointer);
-               exec_op(OP_MOV, &r_m_result.memory_pointer, data);
+            if (!r_m_result.is_memory) {
+                auto dest_reg_ptr = r_m_result.register_pointer;
 
-                print_op(OP_MOV, mem_string.data, read_memory(&r_m_result.memory_pointer), prev_dest, false);
-            } else {
-                printf("mov %s, %d", r_m_result.register_pointer->name, data);
+                event->dest = trace_register(dest_reg_ptr);
 
-                u16 prev_dest = registers[r_m_result.register_pointer->index];
-                exec_op(OP_MOV, r_m_result.register_pointer, data);
+                // exec
+                u16  prev_dest    = registers[dest_reg_ptr->index];
+                u16  prev_flags   = flags_register;
+                bool flags_edited = exec_op(op, dest_reg_ptr, data);
 
-                print_op(OP_MOV, r_m_result.register_pointer->name, registers[r_m_result.register_pointer->index], prev_dest, false);
+                trace_effect(event, SUFFIX_OP, registers[dest_reg_ptr->index], prev_dest, flags_edited, prev_flags);
             }
+            else {
+                event->dest = trace_memory(&r_m_result.memory_pointer);
 
-            printf("\n");
+                u16 prev_dest     = read_memory(&r_m_result.memory_pointer);
+                u16  prev_flags   = flags_register;
+                bool flags_edited = exec_op(op, &r_m_result.memory_pointer, data);
+                trace_effect(event, SUFFIX_OP, read_memory(&r_m_result.memory_pointer), prev_dest, flags_edited, prev_flags);
+            }
         }
-        else if ((instruction >> 2) == 0b100000)
+    }
+
+    else if ((instruction >> 4) == 0b1011)    // mov immediate to register
+    {
+        u8 w   = (instruction & 0b1000);
+        u8 reg = (instruction & 0b0111) | w;
+
+        u16 data = eat_byte();
+        if (w)
+            data |= eat_byte() << 8;
+
+        auto register_pointer   = &register_pointer_table[reg];
+        event->text   = "mov";
+        event->dest   = trace_register(register_pointer);
+        event->source = trace_immediate(OPERAND_IMMEDIATE, data);
+
+        // exec
+        u16 *dest_register      = &registers[register_pointer->index];
+        u16  prev_register_data = *dest_register;
+
+        data <<= register_pointer->shift;
+        data  &= register_pointer->mask;
+        if (!decode_only) {
+            (*dest_register) &= ~register_pointer->mask;
+            (*dest_register) |= data;
+        }
+
+        trace_effect(event, SUFFIX_MOV_IMMEDIATE, *dest_register, prev_register_data);
+    }
+
+    else if ((instruction >> 2) == 0b101000) // memory to accumulator / accumulator to memory
+    {
+        u8 w         = (instruction     ) & 1;
+        u8 direction = (instruction >> 1) & 1;
+
+        u16 addr = eat_byte();
+        addr |= eat_byte() << 8;
+
+        auto accumulator = &register_pointer_table[0b1000]; // always printed as ax
+        auto address     = trace_immediate(OPERAND_DIRECT_ADDRESS, addr);
+        address.access_bytes = w ? 2 : 1;
+
+        event->text = "mov";
+        if (direction) {
+            event->dest   = address;
+            event->source = trace_register(accumulator);
+        } else {
+            event->dest   = trace_register(accumulator);
+            event->source = address;
+        }
+    }
+
+    else if (((instruction >> 1) & 0b1100011) == 0b10)
+    {
+        // 0b0000010 == add immediate to accumulator
+        // 0b0010110 == sub immediate from accumulator
+        // 0b0011110 == cmp immediate with accumulator
+        u8   op_code = (instruction >> 3) & 0b111;
+        auto op      = decode_op(op_code);
+        auto op_str  = op_names[op];
+
+        if (!op_str)
         {
-            u8   op_code = (peek_byte() >> 3) & 0b111;
-            auto op      = decode_op(op_code);
-            auto op_str  = op_names[op];
+            event->kind = TRACE_UNKNOWN_OP;
+            event->text = "register/memory to/from register";
+        }
+        else
+        {
+            u8 w = instruction & 1;
 
-            if (op == OP_UNKNOWN)
+            s16 data;
+            if (w)
             {
-                printf("unknown op: register/memory to register   --> ");
-                print_binary(instruction);
-                printf("\n");
+                data = (s16)eat_byte();
+                data = data | (eat_byte() << 8);
             }
             else
             {
-                u8 w          = (instruction     ) & 1;
-                u8 s          = (instruction >> 1) & 1;
+                data = (s8)eat_byte();
+            }
 
-                u8 mov_extra0 = eat_byte();
 
-                u8 mod = mov_extra0 >> 6;
-                u8 r_m = mov_extra0 & 0b111;
+            event->text   = op_str;
+            event->dest   = trace_register(&register_pointer_table[w << 3]);
+            event->source = trace_immediate(OPERAND_IMMEDIATE, data);
+        }
+    }
 
-                Mod_R_M_Result r_m_result = do_mod_r_m(mod, r_m, w);
+    else if ((instruction >> 4) == 0b0111) // jumps
+    {
+        char *jump_str  = 0;
+        u8    jump_code = instruction & 0b1111;
+        bool  condition = false;
 
-                s16 data;
-                if (!s && w)
-                {
-                    data = eat_byte();
-                    data = data | (eat_byte() << 8);
-                }
-                else
-                    data = (s8)eat_byte();
+        s8 ip_inc8 = eat_byte();
+
+             if (jump_code == 0b0101) {
+            jump_str = "jne";
+            condition = !(flags_register & (1 << ZF));
+        }
+        else if (jump_code == 0b0100) {
+            jump_str = "je";
+            condition =  (flags_register & (1 << ZF));
+        }
+        else if (jump_code == 0b1100) {
+            jump_str = "jl";
+            condition =  (flags_register & ((1 << SF) | (1 << OF)));
+        }
+        else if (jump_code == 0b1110) {
+            jump_str = "jle";
+            condition =  (flags_register & (1 << ZF)) || (((flags_register >> SF) ^ (flags_register >> OF)) & 1);
+        }
+        else if (jump_code == 0b0010) {
+            jump_str = "jb";
+            condition =  (flags_register & (1 << CF));
+        }
+        else if (jump_code == 0b0110) {
+            jump_str = "jbe";
+            condition =  (flags_register & ((1 << CF) | (1 << ZF)));
+        }
+        else if (jump_code == 0b1010) {
+            jump_str = "jp";
+            condition =  (flags_register & (1 << PF));
+        }
+        else if (jump_code == 0b0000) {
+            jump_str = "jo";
+            condition =  (flags_register & (1 << OF));
+        }
+        else if (jump_code == 0b1000) {
+            jump_str = "js";
+            condition =  (flags_register & (1 << SF));
+        }
+        else if (jump_code == 0b1101) {
+            jump_str = "jnl";
+            condition = 0 == (((flags_register >> SF) ^ (flags_register >> OF)) & 1);
+        }
+        else if (jump_code == 0b1111) {
+            jump_str = "jg";
+            condition =  0 == ( (flags_register & (1 << ZF)) && (((flags_register >> SF) ^ (flags_register >> OF)) & 1) );
+        }
+        else if (jump_code == 0b0011) {
+            jump_str = "jnb";
+            condition = 0 == (flags_register & (1 << CF));
+        }
+        else if (jump_code == 0b0111) {
+            jump_str = "ja";
+            condition = 0 == (flags_register & ((1 << CF) | (1 << ZF)));
+        }
+        else if (jump_code == 0b1011) {
+            jump_str = "jnp";
+            condition = 0 == (flags_register & (1 << PF));
+        }
+        else if (jump_code == 0b0001) {
+            jump_str = "jno";
+            condition = 0 == (flags_register & (1 << OF));
+        }
+        else if (jump_code == 0b1001) {
+            jump_str = "jns";
+            condition = 0 == (flags_register & (1 << SF));
+        }
+
+        assert(jump_str);
+
+        event->text = jump_str;
+        event->dest = trace_immediate(OPERAND_RELATIVE, ip_inc8 + 2);
+
+        // exec
+        trace_effect(event, SUFFIX_JUMP, 0, 0);
+
+        event->size  = (u8)(registers[ip] - event->address);
+        event->taken = condition;
+        if (condition && !decode_only) {
+            registers[ip]       += ip_inc8;
+            instruction_pointer += ip_inc8;
+        }
+    }
+    else if ((instruction >> 4) == 0b0101) // push/pop register
+    {
+        auto reg_ptr   = &register_pointer_table[0b1000 | (instruction & 0b111)];
+        u16  prev_dest = registers[reg_ptr->index];
+
+        event->dest    = trace_register(reg_ptr);
+        event->prev_sp = registers[sp];
+        if (instruction & 0b1000) {
+            event->text  = "pop";
+            event->stack = STACK_POP;
+            if (!decode_only)
+                registers[reg_ptr->index] = pop_word();
+
+            trace_effect(event, SUFFIX_POP, registers[reg_ptr->index], prev_dest);
+        } else {
+            event->text  = "push";
+            event->stack = STACK_PUSH;
 
-                char data_str[30] = {};
-                if (s) // signed
-                    sprintf_s(data_str, arr_len(data_str), "%d", data);
-                else
-                    sprintf_s(data_str, arr_len(data_str), "%u", data);
+            // the 8086 decrements sp before reading it, push sp stores the new value
+            u16 data = prev_dest;
+            if (reg_ptr->index == sp)  data -= 2;
+            if (!decode_only)
+                push_word(data);
 
+            trace_effect(event, SUFFIX_STACK, 0, 0);
+        }
+    }
+    else if ((instruction == 0x8F) || (instruction == 0xFF)) // pop, push and call register/memory
+    {
+        u8   op_code = (peek_byte() >> 3) & 0b111;
+        bool is_pop  = (instruction == 0x8F) && (op_code == 0b000);
+        bool is_push = (instruction == 0xFF) && (op_code == 0b110);
+        bool is_call = (instruction == 0xFF) && (op_code == 0b010);
 
+        if (!is_pop && !is_push && !is_call)
+        {
+            event->kind = TRACE_UNKNOWN_OP;
+            event->text = "register/memory";
+        }
+        else
+        {
+            u8 mov_extra0 = eat_byte();
 
-                if (!r_m_result.is_memory) {
-                    auto dest_reg_ptr = r_m_result.register_pointer;
+            u8 mod = mov_extra0 >> 6;
+            u8 r_m = mov_extra0 & 0b111;
 
-                    printf("%s %s, %s", op_str, dest_reg_ptr->name, data_str);
+            Mod_R_M_Result r_m_result = do_mod_r_m(mod, r_m, 1);
+
+            u16 operand_data = 0;
+            if (r_m_result.is_memory) {
+                event->dest  = trace_memory(&r_m_result.memory_pointer);
+                operand_data = read_memory(&r_m_result.memory_pointer);
+            } else {
+                event->dest  = trace_register(r_m_result.register_pointer);
+                operand_data = registers[r_m_result.register_pointer->index];
+            }
+            event->prev_sp = registers[sp];
 
-                    // exec
-                    u16  prev_dest    = registers[dest_reg_ptr->index];
-                    u16  prev_flags   = flags_register;
-                    bool flags_edited = exec_op(op, dest_reg_ptr, data);
+            if (is_pop) {
+                event->text  = "pop";
+                event->stack = STACK_POP;
 
-                    print_op(op, dest_reg_ptr->name, registers[dest_reg_ptr->index], prev_dest, flags_edited, prev_flags);
+                u16 curr_data = operand_data;
+                if (!decode_only) {
+                    curr_data = pop_word();
+                    if (r_m_result.is_memory) exec_op(OP_MOV, &r_m_result.memory_pointer,  curr_data);
+                    else                      exec_op(OP_MOV,  r_m_result.register_pointer, curr_data);
                 }
-                else {
-                    auto mem_string = to_string(&r_m_result.memory_pointer);
 
-                    printf("%s %s, %s", op_str, mem_string.data, data_str);
+                trace_effect(event, SUFFIX_POP, curr_data, operand_data);
+            }
+            else if (is_push) {
+                event->text  = "push";
+                event->stack = STACK_PUSH;
+
+                u16 data = operand_data;
+                if (!r_m_result.is_memory && (r_m_result.register_pointer->index == sp))  data -= 2;
+                if (!decode_only)
+                    push_word(data);
 
-                    u16 prev_dest     = read_memory(&r_m_result.memory_pointer);
-                    u16  prev_flags   = flags_register;
-                    bool flags_edited = exec_op(op, &r_m_result.memory_pointer, data);
-                    print_op(op, mem_string.data, read_memory(&r_m_result.memory_pointer), prev_dest, flags_edited, prev_flags);
+                trace_effect(event, SUFFIX_STACK, 0, 0);
+            }
+            else {
+                event->text     = "call";
+                event->stack    = STACK_PUSH;
+                event->transfer = TRANSFER_CALL;
+                event->taken    = true;
+                event->size     = (u8)(registers[ip] - event->address);
+                if (!decode_only) {
+                    push_word(registers[ip]);
+                    registers[ip]       = operand_data;
+                    instruction_pointer = instruction_start + registers[ip];
                 }
 
-                printf("\n");
+                trace_effect(event, SUFFIX_STACK, 0, 0);
             }
         }
+    }
+    else if (instruction == 0xE8) // call near, direct
+    {
+        u16 ip_inc16 = eat_byte();
+        ip_inc16 |= eat_byte() << 8;
+
+        event->text     = "call";
+        event->dest     = trace_immediate(OPERAND_RELATIVE, (s16)ip_inc16 + 3);
+        event->stack    = STACK_PUSH;
+        event->transfer = TRANSFER_CALL;
+        event->taken    = true;
+        event->prev_sp  = registers[sp];
+        event->size     = (u8)(registers[ip] - event->address);
+        if (!decode_only) {
+            push_word(registers[ip]);
+            registers[ip]      += ip_inc16;
+            instruction_pointer = instruction_start + registers[ip];
+        }
 
-        else if ((instruction >> 4) == 0b1011)    // mov immediate to register
-        {
-            u8 w   = (instruction & 0b1000);
-            u8 reg = (instruction & 0b0111) | w;
+        trace_effect(event, SUFFIX_STACK, 0, 0);
+    }
+    else if ((instruction >> 1) == 0b1100001) // ret, ret with bytes to pop
+    {
+        u16 pop_bytes = 0;
+        if (!(instruction & 1)) {
+            pop_bytes  = eat_byte();
+            pop_bytes |= eat_byte() << 8;
+            event->dest = trace_immediate(OPERAND_IMMEDIATE_UNSIGNED, pop_bytes);
+        }
 
-            u16 data = eat_byte();
-            if (w)
-                data |= eat_byte() << 8;
+        event->text     = "ret";
+        event->stack    = STACK_POP;
+        event->transfer = TRANSFER_RETURN;
+        event->taken    = true;
+        event->prev_sp  = registers[sp];
+        event->size     = (u8)(registers[ip] - event->address);
+        if (!decode_only) {
+            registers[ip]       = pop_word();
+            registers[sp]      += pop_bytes;
+            instruction_pointer = instruction_start + registers[ip];
+        }
+
+        trace_effect(event, SUFFIX_STACK, 0, 0);
+    }
+    else if ((instruction >> 1) == 0b1001110) // pushf, popf
+    {
+        u16 prev_flags = flags_register;
 
-            auto register_pointer   =  register_pointer_table[reg];
-            printf("mov %s, %d", register_pointer.name, data);
+        event->prev_sp = registers[sp];
+        if (instruction & 1) {
+            event->text  = "popf";
+            event->stack = STACK_POP;
 
-            // exec
-            u16 *dest_register      = &registers[register_pointer.index];
-            u16  prev_register_data = *dest_register;
+            if (!decode_only)
+                flags_register = flags_from_8086(pop_word());
 
-            data <<= register_pointer.shift;
-            data  &= register_pointer.mask;
-            (*dest_register) &= ~register_pointer.mask;
-            (*dest_register) |= data;
+            trace_effect(event, SUFFIX_STACK, 0, 0, true, prev_flags);
+        } else {
+            event->text  = "pushf";
+            event->stack = STACK_PUSH;
+            if (!decode_only)
+                push_word(flags_to_8086(flags_register));
 
-            printf("   \t; %s:0x%04x -> 0x%04x\tip:0x%04x\n", register_pointer.name, prev_register_data, *dest_register, registers[ip]);
+            trace_effect(event, SUFFIX_STACK, 0, 0);
         }
+    }
 
-        else if ((instruction >> 2) == 0b101000) // memory to accumulator / accumulator to memory
-        {
-            u8 w         = (instruction     ) & 1;
-            u8 direction = (instruction >> 1) & 1;
+    else if ((instruction >> 4) == 0b1110) // loops
+    {
+        char *loop_str = 0;
+        u8 loop_code = instruction & 0b1111;
+             if (loop_code == 0b0010)
+            loop_str = "loop";
+        else if (loop_code == 0b0001)
+            loop_str = "loopz";
+        else if (loop_code == 0b0000)
+            loop_str = "loopnz";
+        else if (loop_code == 0b0011)
+            loop_str = "jcxz";
+
+        assert(loop_str);
+        s8 ip_inc8 = eat_byte();
+
+        event->text = loop_str;
+        event->dest = trace_immediate(OPERAND_RELATIVE, ip_inc8 + 2);
+    }
 
-            u16 addr = eat_byte();
-            addr |= eat_byte() << 8;
+    else
+    {
+        event->kind = TRACE_UNKNOWN;
+    }
 
-            if (direction)
-                printf("mov [%d], ax\n", addr);
-            else
-                printf("mov ax, [%d]\n", addr);
-        }
+    if (!event->size)
+        event->size = (u8)(registers[ip] - event->address);
+}
 
-        else if (((instruction >> 1) & 0b1100011) == 0b10)
-        {
-            // 0b0000010 == add immediate to accumulator
-            // 0b0010110 == sub immediate from accumulator
-            // 0b0011110 == cmp immediate with accumulator
-            u8   op_code = (instruction >> 3) & 0b111;
-            auto op      = decode_op(op_code);
-            auto op_str  = op_names[op];
-
-            if (!op_str)
-            {
-                printf("unknown op: register/memory to/from register   --> ");
-                print_binary(instruction);
-                printf("\n");
+#if !SIM86_NO_MAIN
+int main(int args_count, char *args[])
+{
+    // -quiet:   no trace, only the final state
+    // -serial:  format the trace on the simulation thread
+    // -biu:     cycle-level timing with the 8086 prefetch queue model
+    // -biu8088: same, 8088 flavour
+    // -cfg <file.dot>: static analysis only, writes the control-flow graph
+    // -wide <count>:  parameter sweep, runs count instances 16 at a time in lockstep
+    // -sweep <reg> <start> <step>: instance n starts with reg = start + n*step (repeatable)
+    // -scalar:        run the sweep one instance at a time
+    // -callgraph <file.txt>: per-routine profile, writes collapsed stacks for flamegraphs
+    char     *file_name           = 0;
+    char     *cfg_file_name       = 0;
+    char     *callgraph_file_name = 0;
+    Biu_Model biu_mode            = BIU_OFF;
+    u64       cpu_frequency       = 0;
+    u32       instance_count      = 0;
+    bool      force_scalar        = false;
+    for (int it = 1; it < args_count; it += 1) {
+        if      ((strcmp(args[it], "-cfg") == 0) && (it + 1 < args_count)) {
+            cfg_file_name = args[it + 1];
+            it += 1;
+        }
+        else if ((strcmp(args[it], "-callgraph") == 0) && (it + 1 < args_count)) {
+            callgraph_file_name = args[it + 1];
+            it += 1;
+        }
+        else if ((strcmp(args[it], "-wide") == 0) && (it + 1 < args_count)) {
+            instance_count = (u32)strtoul(args[it + 1], 0, 0);
+            it += 1;
+        }
+        else if ((strcmp(args[it], "-sweep") == 0) && (it + 3 < args_count)) {
+            u16 start = (u16)strtol(args[it + 2], 0, 0);
+            u16 step  = (u16)strtol(args[it + 3], 0, 0);
+            if (!wide_add_sweep(args[it + 1], start, step)) {
+                printf("ERROR: cannot sweep '%s', expected a 16-bit register.\n", args[it + 1]);
+                return 1;
             }
-            else
-            {
-                u8 w = instruction & 1;
+            it += 3;
+        }
+        else if (strcmp(args[it], "-scalar")  == 0) force_scalar = true;
+        else if (strcmp(args[it], "-quiet")   == 0) trace_mode = TRACE_OFF;
+        else if (strcmp(args[it], "-serial")  == 0) trace_mode = TRACE_SERIAL;
+        else if (strcmp(args[it], "-biu")     == 0) biu_mode   = BIU_8086;
+        else if (strcmp(args[it], "-biu8088") == 0) biu_mode   = BIU_8088;
+        else                                        file_name  = args[it];
+    }
+    if (!file_name) return 0;
 
-                s16 data;
-                if (w)
-                {
-                    data = (s16)eat_byte();
-                    data = data | (eat_byte() << 8);
-                }
-                else
-                {
-                    data = (s8)eat_byte();
-                }
+#if SIM86_PROFILER
+    // the profiler is not thread-safe, format on the simulation thread to time it
+    if (trace_mode == TRACE_PIPELINED)
+        trace_mode = TRACE_SERIAL;
 
+    cpu_frequency = estimate_cpu_frequency(100);
+    start_profiling();
+#endif
 
-                printf("%s %s, %d\n", op_str, (w) ? "ax" : "al", data);
-            }
-        }
+    FILE *in_file = 0;
+    if (fopen_s(&in_file, file_name, "rb"))
+    {
+        printf("ERROR: File '%s' could not be opened.\n", file_name);
+        return 1;
+    }
 
-        else if ((instruction >> 4) == 0b0111) // jumps
-        {
-            char *jump_str  = 0;
-            u8    jump_code = instruction & 0b1111;
-            bool  condition = false;
 
-            s8 ip_inc8 = eat_byte();
+    fseek(in_file, 0, SEEK_END);
+    s64 size = ftell(in_file);
+    fseek(in_file, 0, SEEK_SET);
 
-                 if (jump_code == 0b0101) {
-                jump_str = "jne";
-                condition = !(flags_register & (1 << ZF));
-            }
-            else if (jump_code == 0b0100) {
-                jump_str = "je";
-                condition =  (flags_register & (1 << ZF));
-            }
-            else if (jump_code == 0b1100) {
-                jump_str = "jl";
-                condition =  (flags_register & ((1 << SF) | (1 << OF)));
-            }
-            else if (jump_code == 0b1110) {
-                jump_str = "jle";
-                condition =  (flags_register & (1 << ZF)) || (((flags_register >> SF) ^ (flags_register >> OF)) & 1);
-            }
-            else if (jump_code == 0b0010) {
-                jump_str = "jb";
-                condition =  (flags_register & (1 << CF));
-            }
-            else if (jump_code == 0b0110) {
-                jump_str = "jbe";
-                condition =  (flags_register & ((1 << CF) | (1 << ZF)));
-            }
-            else if (jump_code == 0b1010) {
-                jump_str = "jp";
-                condition =  (flags_register & (1 << PF));
-            }
-            else if (jump_code == 0b0000) {
-                jump_str = "jo";
-                condition =  (flags_register & (1 << OF));
-            }
-            else if (jump_code == 0b1000) {
-                jump_str = "js";
-                condition =  (flags_register & (1 << SF));
-            }
-            else if (jump_code == 0b1101) {
-                jump_str = "jnl";
-                condition = 0 == (((flags_register >> SF) ^ (flags_register >> OF)) & 1);
-            }
-            else if (jump_code == 0b1111) {
-                jump_str = "jg";
-                condition =  0 == ( (flags_register & (1 << ZF)) && (((flags_register >> SF) ^ (flags_register >> OF)) & 1) );
-            }
-            else if (jump_code == 0b0011) {
-                jump_str = "jnb";
-                condition = 0 == (flags_register & (1 << CF));
-            }
-            else if (jump_code == 0b0111) {
-                jump_str = "ja";
-                condition = 0 == (flags_register & ((1 << CF) | (1 << ZF)));
-            }
-            else if (jump_code == 0b1011) {
-                jump_str = "jnp";
-                condition = 0 == (flags_register & (1 << PF));
-            }
-            else if (jump_code == 0b0001) {
-                jump_str = "jno";
-                condition = 0 == (flags_register & (1 << OF));
-            }
-            else if (jump_code == 0b1001) {
-                jump_str = "jns";
-                condition = 0 == (flags_register & (1 << SF));
-            }
+    instruction_start  = (u8  *)malloc(size * sizeof(u8));
+    instruction_end    = instruction_start + size;
+    {
+        time_bandwidth("file read", size);
+        fread(instruction_start, sizeof(u8), size, in_file);
+    }
+    fclose(in_file);
 
-            assert(jump_str);
+    instruction_pointer = instruction_start;
 
-            printf("%s $%+d", jump_str, ip_inc8 + 2);
+    if (cfg_file_name) {
+        analyze_cfg(cfg_file_name);
+        end_and_report_profiling(cpu_frequency);
+        return 0;
+    }
 
-            // exec
-            printf("  \t; ip:0x%x\n", registers[ip]);
+    if (instance_count) {
+        int result = run_sweep(instance_count, force_scalar, trace_mode != TRACE_OFF);
+        end_and_report_profiling(cpu_frequency);
+        return result;
+    }
 
-            if (condition) {
-                registers[ip]       += ip_inc8;
-                instruction_pointer += ip_inc8;
-            }
-        }
-        else if ((instruction >> 4) == 0b1110) // loops
-        {
-            char *loop_str = 0;
-            u8 loop_code = instruction & 0b1111;
-                 if (loop_code == 0b0010)
-                loop_str = "loop";
-            else if (loop_code == 0b0001)
-                loop_str = "loopz";
-            else if (loop_code == 0b0000)
-                loop_str = "loopnz";
-            else if (loop_code == 0b0011)
-                loop_str = "jcxz";
-
-            assert(loop_str);
-            s8 ip_inc8 = eat_byte();
-            printf("%s $%+d\n", loop_str, ip_inc8 + 2);
-        }
+    printf("bits 16\n\n");
+    if (biu_mode != BIU_OFF)
+        biu_begin(biu_mode);
 
-        else
-        {
-            printf("unknown: %x    ", instruction);
-            print_binary(instruction);
-            printf("\n");
-        }
+    if (callgraph_file_name)
+        callgraph_begin(registers[ip]);
+
+    trace_begin();
+    while (instruction_pointer < instruction_end) {
+        u64 start_time = instruction_timer_start();
+
+        Trace_Event event = {};
+        execute_instruction(&event);
+        if (biu_model != BIU_OFF)
+            biu_time_instruction(&event);
+        if (callgraph_enabled)
+            callgraph_instruction(&event);
+        trace_push(&event);
 
+        instruction_timer_end(event.instruction, event.transfer != TRANSFER_NONE, start_time);
     }
+    trace_end();
 
     char final_flags_str[FLAGS_COUNT + 1] = {};
     fill_flags_string(flags_register, final_flags_str);
@@ -821,6 +1154,15 @@ int main(int args_count, char *args[])
                        printf(";  flags: %s", final_flags_str);
 
     printf("\n");
+
+    biu_report();
+    callgraph_end(callgraph_file_name);
+    end_and_report_profiling(cpu_frequency);
     
     return 0;
 }
+#endif // !SIM86_NO_MAIN
+
+#if SIM86_PROFILER
+static_assert(__COUNTER__ < MAX_PROFILER_HOOKS, "too many profiler blocks, raise MAX_PROFILER_HOOKS");
+#endif
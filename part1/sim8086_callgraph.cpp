@@ -0,0 +1,282 @@
+// sim8086_callgraph.cpp
+//
+// Call-graph profiler. A shadow stack follows call and ret: every executed
+// instruction is charged to the routine on top of it (exclusive), and each
+// activation adds what ran between its call and its return to the routine
+// (inclusive, counted once per routine when it recurses). Clocks are the BIU
+// clocks with -biu, EU clocks from the 8086 manual otherwise.
+//
+// Routines are named after their entry address, the code that runs before
+// the first call is "start". Prints a flat profile and writes collapsed
+// stacks ("start;sub_0010;sub_0040 clocks" per line) for flamegraph.pl.
+
+#define CALL_NODE_NONE -1
+
+struct Routine_Profile {
+    u64 calls;
+    u64 exclusive_instructions;
+    u64 inclusive_instructions;
+    u64 exclusive_clocks;
+    u64 inclusive_clocks;
+    u32 active;   // activations on the shadow stack
+    bool seen;
+};
+
+// calling-context tree, one node per distinct chain of calls
+struct Call_Node {
+    u16 routine;
+    s32 parent;
+    s32 first_child;
+    s32 next_sibling;
+    u64 instructions;
+    u64 clocks;
+};
+
+struct Call_Frame {
+    u16 routine;
+    u16 return_address;
+    s32 node;
+    u64 entry_instructions;
+    u64 entry_clocks;
+};
+
+struct Call_Graph {
+    Call_Frame *frames;
+    u32         frame_count;
+    u32         frame_capacity;
+
+    Call_Node  *nodes;
+    u32         node_count;
+    u32         node_capacity;
+
+    u64 instructions;
+    u64 clocks;
+    u64 unmatched_returns; // ret with no matching call, the stack was edited by hand
+};
+
+static bool            callgraph_enabled;
+static Call_Graph      callgraph;
+static Routine_Profile routine_profiles[0x10000]; // indexed by entry address
+
+s32 callgraph_child(s32 parent, u16 routine) {
+    for (s32 it = callgraph.nodes[parent].first_child; it != CALL_NODE_NONE; it = callgraph.nodes[it].next_sibling) {
+        if (callgraph.nodes[it].routine == routine)  return it;
+    }
+
+    if (callgraph.node_count == callgraph.node_capacity) {
+        callgraph.node_capacity *= 2;
+        callgraph.nodes = (Call_Node *)realloc(callgraph.nodes, callgraph.node_capacity * sizeof(Call_Node));
+    }
+
+    s32  index = (s32)callgraph.node_count;
+    auto node  = &callgraph.nodes[index];
+    callgraph.node_count += 1;
+
+    *node = {};
+    node->routine      = routine;
+    node->parent       = parent;
+    node->first_child  = CALL_NODE_NONE;
+    node->next_sibling = callgraph.nodes[parent].first_child;
+    callgraph.nodes[parent].first_child = index;
+
+    return index;
+}
+
+void callgraph_push_frame(u16 routine, u16 return_address, s32 node) {
+    if (callgraph.frame_count == callgraph.frame_capacity) {
+        callgraph.frame_capacity *= 2;
+        callgraph.frames = (Call_Frame *)realloc(callgraph.frames, callgraph.frame_capacity * sizeof(Call_Frame));
+    }
+
+    auto frame = &callgraph.frames[callgraph.frame_count];
+    callgraph.frame_count += 1;
+
+    frame->routine            = routine;
+    frame->return_address     = return_address;
+    frame->node               = node;
+    frame->entry_instructions = callgraph.instructions;
+    frame->entry_clocks       = callgraph.clocks;
+
+    auto profile = &routine_profiles[routine];
+    profile->seen    = true;
+    profile->calls  += 1;
+    profile->active += 1;
+}
+
+void callgraph_pop_frame() {
+    callgraph.frame_count -= 1;
+    auto frame   = &callgraph.frames[callgraph.frame_count];
+    auto profile = &routine_profiles[frame->routine];
+
+    profile->active -= 1;
+    if (!profile->active) {
+        profile->inclusive_instructions += callgraph.instructions - frame->entry_instructions;
+        profile->inclusive_clocks       += callgraph.clocks       - frame->entry_clocks;
+    }
+}
+
+void callgraph_begin(u16 entry_address) {
+    callgraph_enabled = true;
+
+    callgraph = {};
+    callgraph.frame_capacity = 64;
+    callgraph.frames         = (Call_Frame *)malloc(callgraph.frame_capacity * sizeof(Call_Frame));
+    callgraph.node_capacity  = 256;
+    callgraph.nodes          = (Call_Node *)malloc(callgraph.node_capacity * sizeof(Call_Node));
+
+    callgraph.node_count = 1;
+    callgraph.nodes[0]   = {};
+    callgraph.nodes[0].routine      = entry_address;
+    callgraph.nodes[0].parent       = CALL_NODE_NONE;
+    callgraph.nodes[0].first_child  = CALL_NODE_NONE;
+    callgraph.nodes[0].next_sibling = CALL_NODE_NONE;
+
+    callgraph_push_frame(entry_address, 0, 0);
+}
+
+// after the instruction executed (and was timed, with -biu)
+void callgraph_instruction(Trace_Event *event) {
+    u64 clocks = event->timed ? event->clocks : eu_cost(event).clocks;
+
+    // the call itself belongs to the caller, the ret to the callee
+    auto top = &callgraph.frames[callgraph.frame_count - 1];
+    auto profile = &routine_profiles[top->routine];
+    profile->exclusive_instructions += 1;
+    profile->exclusive_clocks       += clocks;
+    callgraph.nodes[top->node].instructions += 1;
+    callgraph.nodes[top->node].clocks       += clocks;
+
+    callgraph.instructions += 1;
+    callgraph.clocks       += clocks;
+
+    if (event->transfer == TRANSFER_CALL) {
+        u16 routine = event->ip;
+        s32 node    = callgraph_child(top->node, routine);
+        callgraph_push_frame(routine, (u16)(event->address + event->size), node);
+    }
+    else if (event->transfer == TRANSFER_RETURN) {
+        // unwinds to the frame the ret goes back to, the bottom frame never returns
+        u32 match = 0;
+        for (u32 it = callgraph.frame_count - 1; it > 0; it -= 1) {
+            if (callgraph.frames[it].return_address == event->ip) {
+                match = it;
+                break;
+            }
+        }
+
+        if (!match) {
+            callgraph.unmatched_returns += 1;
+            return;
+        }
+
+        while (callgraph.frame_count > match)
+            callgraph_pop_frame();
+    }
+}
+
+char *routine_name(u16 address, char *buffer, u32 buffer_size) {
+    if (address == callgraph.nodes[0].routine)
+        sprintf_s(buffer, buffer_size, "start");
+    else
+        sprintf_s(buffer, buffer_size, "sub_%04x", address);
+    return buffer;
+}
+
+// preorder walk with an explicit stack, a deep recursion in the program must not
+// overflow ours; no path is longer than the tree has nodes
+void callgraph_write_collapsed(FILE *out) {
+    s32 *path        = (s32 *)malloc(callgraph.node_count * sizeof(s32));
+    s32 *stack       = (s32 *)malloc(callgraph.node_count * sizeof(s32));
+    u32 *stack_depth = (u32 *)malloc(callgraph.node_count * sizeof(u32));
+    u32  stack_count = 0;
+
+    stack[stack_count]       = 0;
+    stack_depth[stack_count] = 0;
+    stack_count += 1;
+
+    char name[16];
+    while (stack_count) {
+        stack_count -= 1;
+        s32 node_index = stack[stack_count];
+        u32 depth      = stack_depth[stack_count];
+        auto node      = &callgraph.nodes[node_index];
+        path[depth] = node_index;
+
+        if (node->clocks) {
+            for (u32 it = 0; it <= depth; it += 1) {
+                fprintf(out, "%s", routine_name(callgraph.nodes[path[it]].routine, name, sizeof(name)));
+                if (it < depth)  fprintf(out, ";");
+            }
+            fprintf(out, " %llu\n", node->clocks);
+        }
+
+        // children are pushed in reverse, so that they come out in list order
+        u32 first_child = stack_count;
+        for (s32 it = node->first_child; it != CALL_NODE_NONE; it = callgraph.nodes[it].next_sibling) {
+            stack[stack_count]       = it;
+            stack_depth[stack_count] = depth + 1;
+            stack_count += 1;
+        }
+        for (u32 low = first_child, high = stack_count; low + 1 < high; low += 1, high -= 1) {
+            s32 child       = stack[low];
+            stack[low]      = stack[high - 1];
+            stack[high - 1] = child;
+        }
+    }
+
+    free(path);
+    free(stack);
+    free(stack_depth);
+}
+
+int compare_routines_by_inclusive_clocks(const void *a, const void *b) {
+    auto profile_a = &routine_profiles[*(u16 *)a];
+    auto profile_b = &routine_profiles[*(u16 *)b];
+    if (profile_a->inclusive_clocks != profile_b->inclusive_clocks)
+        return (profile_a->inclusive_clocks > profile_b->inclusive_clocks) ? -1 : 1;
+    return (*(u16 *)a < *(u16 *)b) ? -1 : 1;
+}
+
+void callgraph_end(char *collapsed_file_name) {
+    if (!callgraph_enabled)  return;
+
+    while (callgraph.frame_count)
+        callgraph_pop_frame();
+
+    u16 *routines      = (u16 *)malloc(0x10000 * sizeof(u16));
+    u32  routine_count = 0;
+    for (u32 it = 0; it < arr_len(routine_profiles); it += 1) {
+        if (!routine_profiles[it].seen)  continue;
+        routines[routine_count] = (u16)it;
+        routine_count += 1;
+    }
+    qsort(routines, routine_count, sizeof(u16), compare_routines_by_inclusive_clocks);
+
+    printf("\n; Call graph: %llu instructions, %llu clocks (%s)\n", callgraph.instructions, callgraph.clocks,
+           (biu_model != BIU_OFF) ? "biu" : "eu only");
+    if (callgraph.unmatched_returns)
+        printf(";   %llu returns did not match a call\n", callgraph.unmatched_returns);
+    printf(";   routine       calls  instructions (excl)  instructions (incl)  clocks (excl)  clocks (incl)   incl %%\n");
+    for (u32 it = 0; it < routine_count; it += 1) {
+        auto profile = &routine_profiles[routines[it]];
+
+        char name[16];
+        f64  percentage = callgraph.clocks ? 100.0 * (f64)profile->inclusive_clocks / (f64)callgraph.clocks : 0.0;
+        printf(";   %-10s %8llu  %19llu  %19llu  %13llu  %13llu  %6.2f%%\n",
+               routine_name(routines[it], name, sizeof(name)), profile->calls,
+               profile->exclusive_instructions, profile->inclusive_instructions,
+               profile->exclusive_clocks, profile->inclusive_clocks, percentage);
+    }
+    free(routines);
+
+    FILE *out = 0;
+    if (fopen_s(&out, collapsed_file_name, "wb"))
+    {
+        printf("ERROR: File '%s' could not be opened.\n", collapsed_file_name);
+        return;
+    }
+    callgraph_write_collapsed(out);
+    fclose(out);
+
+    printf("; Collapsed stacks written to '%s'\n", collapsed_file_name);
+}
@@ -0,0 +1,521 @@
+// sim8086_cfg.cpp
+//
+// Static analysis: decodes the whole image with the regular handlers in
+// decode_only mode, splits it into basic blocks at jcc/loop/jcxz targets and
+// after every branch, finds natural loops (back edges to a dominating header)
+// and writes the control-flow graph as a DOT file. Block clocks are EU clocks
+// from sim8086_timing.cpp, prefetch stalls are not included.
+//
+// Direct calls add an edge to the routine and fall through to the return
+// address, returns end a block with no successors, so routines show up as
+// parts of one graph and recursion as a loop.
+//
+// Running past the last byte is how a program exits: jumps to the end of the
+// image and the fallthrough of the last instruction go to an empty exit block.
+
+#define NO_BLOCK -1
+
+enum Edge_Kind {
+    EDGE_FALLTHROUGH,
+    EDGE_TAKEN,
+    EDGE_CALL,
+};
+
+struct Cfg_Edge {
+    s32       to;
+    Edge_Kind kind;
+    bool      is_back_edge;
+};
+
+struct Basic_Block {
+    u16 first_address;
+    u32 first_instruction;
+    u32 instruction_count;
+
+    u32 clocks;            // every instruction not taken
+    u32 taken_clocks;      // extra clocks when the terminating branch is taken
+
+    Cfg_Edge successors[2];
+    u32      successor_count;
+
+    s32  idom;             // immediate dominator, NO_BLOCK when unreachable
+    s32  rpo_index;
+    u32  loop_depth;
+    bool is_loop_header;
+    bool is_exit;          // the pseudo-block at the end of the image, no instructions
+};
+
+struct Cfg_Loop {
+    s32 header;
+    u32 block_count;
+    u32 clocks;            // one pass through every block of the body
+};
+
+struct Cfg {
+    Trace_Event *instructions;
+    u32          instruction_count;
+
+    Basic_Block *blocks;
+    u32          block_count;
+    s32         *block_of_address; // 0x10000 entries, NO_BLOCK between instructions
+    s32          exit_block;       // NO_BLOCK when nothing runs past the end
+
+    s32         *rpo;              // reachable blocks, reverse post-order
+    u32          rpo_count;
+
+    u32         *pred_start;       // predecessors of block b are preds[pred_start[b]..pred_start[b + 1]]
+    s32         *preds;
+
+    Cfg_Loop    *loops;
+    u32          loop_count;
+};
+
+// jcc, loop and jcxz
+inline bool is_branch(Trace_Event *event) {
+    if (event->kind != TRACE_INSTRUCTION)  return false;
+    return ((event->instruction >> 4) == 0b0111) || ((event->instruction >> 2) == 0b111000);
+}
+
+inline bool is_direct_call(Trace_Event *event) {
+    return (event->transfer == TRANSFER_CALL) && (event->dest.kind == OPERAND_RELATIVE);
+}
+
+inline bool ends_block(Trace_Event *event) {
+    return is_branch(event) || (event->transfer != TRANSFER_NONE);
+}
+
+// dest of a jump is "$+n", relative to the start of the instruction
+inline s32 branch_target(Trace_Event *event) {
+    return (s32)event->address + event->dest.immediate;
+}
+
+void cfg_decode(Cfg *cfg) {
+    u32 image_size = (u32)(instruction_end - instruction_start);
+
+    cfg->instructions      = (Trace_Event *)calloc(image_size, sizeof(Trace_Event));
+    cfg->instruction_count = 0;
+
+    decode_only = true;
+    while (instruction_pointer < instruction_end) {
+        Trace_Event *event = &cfg->instructions[cfg->instruction_count];
+        execute_instruction(event);
+        cfg->instruction_count += 1;
+    }
+    decode_only = false;
+}
+
+void cfg_build_blocks(Cfg *cfg) {
+    s32 image_size = (s32)(instruction_end - instruction_start);
+
+    cfg->block_of_address = (s32 *)malloc(0x10000 * sizeof(s32));
+    for (u32 it = 0; it < 0x10000; it += 1)  cfg->block_of_address[it] = NO_BLOCK;
+
+    // leaders: entry, branch targets, instructions after a branch
+    bool *is_instruction_start = (bool *)calloc(0x10000, sizeof(bool));
+    bool *is_leader            = (bool *)calloc(0x10000, sizeof(bool));
+    for (u32 it = 0; it < cfg->instruction_count; it += 1)
+        is_instruction_start[cfg->instructions[it].address] = true;
+
+    bool exits = false;
+    if (cfg->instruction_count) {
+        is_leader[cfg->instructions[0].address] = true;
+        exits = (cfg->instructions[cfg->instruction_count - 1].transfer != TRANSFER_RETURN);
+    }
+
+    for (u32 it = 0; it < cfg->instruction_count; it += 1) {
+        auto event = &cfg->instructions[it];
+        if (!ends_block(event))  continue;
+
+        if (is_branch(event) || is_direct_call(event)) {
+            s32 target = branch_target(event);
+            if (target == image_size)
+                exits = true;
+            else if ((target >= 0) && (target < 0x10000) && is_instruction_start[target])
+                is_leader[target] = true;
+            else
+                printf("; warning: %s at 0x%04x jumps to 0x%04x, which is not the start of an instruction\n", event->text, event->address, target & 0xFFFF);
+        }
+
+        if (it + 1 < cfg->instruction_count)
+            is_leader[cfg->instructions[it + 1].address] = true;
+    }
+
+    cfg->blocks      = (Basic_Block *)calloc(cfg->instruction_count + 2, sizeof(Basic_Block));
+    cfg->block_count = 0;
+    for (u32 it = 0; it < cfg->instruction_count; it += 1) {
+        auto event = &cfg->instructions[it];
+        if (is_leader[event->address]) {
+            auto block = &cfg->blocks[cfg->block_count];
+            block->first_address     = event->address;
+            block->first_instruction = it;
+            block->idom              = NO_BLOCK;
+            block->rpo_index         = NO_BLOCK;
+            cfg->block_count += 1;
+        }
+
+        auto block = &cfg->blocks[cfg->block_count - 1];
+        block->instruction_count += 1;
+        cfg->block_of_address[event->address] = (s32)(cfg->block_count - 1);
+
+        // static estimate: branches not taken, what taking the last one adds is kept apart
+        event->taken = false;
+        u32 not_taken_clocks = eu_cost(event).clocks;
+        block->clocks += not_taken_clocks;
+        if (is_branch(event)) {
+            event->taken = true;
+            block->taken_clocks = eu_cost(event).clocks - not_taken_clocks;
+            event->taken = false;
+        }
+    }
+
+    cfg->exit_block = NO_BLOCK;
+    if (exits) {
+        auto block = &cfg->blocks[cfg->block_count];
+        block->first_address     = (u16)image_size;
+        block->first_instruction = cfg->instruction_count;
+        block->idom              = NO_BLOCK;
+        block->rpo_index         = NO_BLOCK;
+        block->is_exit           = true;
+        cfg->exit_block   = (s32)cfg->block_count;
+        cfg->block_count += 1;
+    }
+
+    for (u32 it = 0; it < cfg->block_count; it += 1) {
+        auto block = &cfg->blocks[it];
+        if (block->is_exit)  continue;
+
+        u32  last  = block->first_instruction + block->instruction_count - 1;
+        auto event = &cfg->instructions[last];
+
+        if (is_branch(event) || is_direct_call(event)) {
+            s32 target = branch_target(event);
+            s32 to     = NO_BLOCK;
+            if (target == image_size)
+                to = cfg->exit_block;
+            else if ((target >= 0) && (target < 0x10000))
+                to = cfg->block_of_address[target];
+
+            if (to != NO_BLOCK) {
+                auto edge  = &block->successors[block->successor_count];
+                edge->to   = to;
+                edge->kind = is_branch(event) ? EDGE_TAKEN : EDGE_CALL;
+                block->successor_count += 1;
+            }
+        }
+
+        // every branch we decode is conditional, so there is always a fallthrough,
+        // calls continue there once the routine returns, the last instruction exits
+        if (event->transfer != TRANSFER_RETURN) {
+            auto edge  = &block->successors[block->successor_count];
+            edge->kind = EDGE_FALLTHROUGH;
+            if (last + 1 < cfg->instruction_count)
+                edge->to = cfg->block_of_address[cfg->instructions[last + 1].address];
+            else
+                edge->to = cfg->exit_block;
+            block->successor_count += 1;
+        }
+    }
+
+    free(is_instruction_start);
+    free(is_leader);
+}
+
+s32 dominator_intersect(Cfg *cfg, s32 a, s32 b) {
+    while (a != b) {
+        while (cfg->blocks[a].rpo_index > cfg->blocks[b].rpo_index)  a = cfg->blocks[a].idom;
+        while (cfg->blocks[b].rpo_index > cfg->blocks[a].rpo_index)  b = cfg->blocks[b].idom;
+    }
+    return a;
+}
+
+bool dominates(Cfg *cfg, s32 dominator, s32 block) {
+    for (;;) {
+        if (block == dominator)  return true;
+
+        s32 idom = cfg->blocks[block].idom;
+        if (idom == block)  return false; // reached the entry
+        block = idom;
+    }
+}
+
+// Cooper, Harvey, Kennedy: "A Simple, Fast Dominance Algorithm"
+void cfg_find_dominators(Cfg *cfg) {
+    if (!cfg->block_count)  return;
+
+    // reverse post-order from the entry block
+    cfg->rpo       = (s32 *)malloc(cfg->block_count * sizeof(s32));
+    cfg->rpo_count = 0;
+
+    s32  *post_order  = (s32 *)malloc(cfg->block_count * sizeof(s32));
+    s32  *stack       = (s32 *)malloc(cfg->block_count * sizeof(s32));
+    u32  *next_edge   = (u32 *)calloc(cfg->block_count, sizeof(u32));
+    bool *visited     = (bool *)calloc(cfg->block_count, sizeof(bool));
+    u32   post_count  = 0;
+    u32   stack_count = 0;
+
+    stack[stack_count] = 0;
+    stack_count += 1;
+    visited[0] = true;
+    while (stack_count) {
+        s32  top   = stack[stack_count - 1];
+        auto block = &cfg->blocks[top];
+        if (next_edge[top] < block->successor_count) {
+            s32 to = block->successors[next_edge[top]].to;
+            next_edge[top] += 1;
+            if (!visited[to]) {
+                visited[to] = true;
+                stack[stack_count] = to;
+                stack_count += 1;
+            }
+        } else {
+            post_order[post_count] = top;
+            post_count  += 1;
+            stack_count -= 1;
+        }
+    }
+
+    for (u32 it = 0; it < post_count; it += 1) {
+        s32 block_index = post_order[post_count - 1 - it];
+        cfg->rpo[it] = block_index;
+        cfg->blocks[block_index].rpo_index = (s32)it;
+    }
+    cfg->rpo_count = post_count;
+
+    // predecessors, as a flat list per block
+    u32 *pred_start = (u32 *)calloc(cfg->block_count + 1, sizeof(u32));
+    cfg->pred_start = pred_start;
+    for (u32 it = 0; it < cfg->block_count; it += 1) {
+        auto block = &cfg->blocks[it];
+        for (u32 edge = 0; edge < block->successor_count; edge += 1)
+            pred_start[block->successors[edge].to + 1] += 1;
+    }
+    for (u32 it = 0; it < cfg->block_count; it += 1)  pred_start[it + 1] += pred_start[it];
+
+    s32 *preds     = (s32 *)malloc((pred_start[cfg->block_count] + 1) * sizeof(s32));
+    cfg->preds = preds;
+    u32 *pred_fill = (u32 *)calloc(cfg->block_count, sizeof(u32));
+    for (u32 it = 0; it < cfg->block_count; it += 1) {
+        auto block = &cfg->blocks[it];
+        for (u32 edge = 0; edge < block->successor_count; edge += 1) {
+            s32 to = block->successors[edge].to;
+            preds[pred_start[to] + pred_fill[to]] = (s32)it;
+            pred_fill[to] += 1;
+        }
+    }
+
+    cfg->blocks[0].idom = 0;
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (u32 it = 1; it < cfg->rpo_count; it += 1) {
+            s32 block_index = cfg->rpo[it];
+            s32 new_idom    = NO_BLOCK;
+            for (u32 pred = pred_start[block_index]; pred < pred_start[block_index + 1]; pred += 1) {
+                s32 p = preds[pred];
+                if (cfg->blocks[p].idom == NO_BLOCK)  continue;
+
+                if (new_idom == NO_BLOCK) new_idom = p;
+                else                      new_idom = dominator_intersect(cfg, p, new_idom);
+            }
+
+            if (cfg->blocks[block_index].idom != new_idom) {
+                cfg->blocks[block_index].idom = new_idom;
+                changed = true;
+            }
+        }
+    }
+
+    free(post_order);
+    free(stack);
+    free(next_edge);
+    free(visited);
+    free(pred_fill);
+}
+
+// a back edge goes to a block that dominates its source; the natural loop of a
+// header is everything that reaches one of its back edges without going through it
+void cfg_find_loops(Cfg *cfg) {
+    cfg->loops      = (Cfg_Loop *)calloc(cfg->block_count + 1, sizeof(Cfg_Loop));
+    cfg->loop_count = 0;
+
+    s32 *in_loop = (s32 *)malloc(cfg->block_count * sizeof(s32));
+    s32 *stack   = (s32 *)malloc(cfg->block_count * sizeof(s32));
+    for (u32 it = 0; it < cfg->block_count; it += 1)  in_loop[it] = NO_BLOCK;
+
+    // outer headers come first in reverse post-order
+    for (u32 rpo_it = 0; rpo_it < cfg->rpo_count; rpo_it += 1) {
+        s32  header        = cfg->rpo[rpo_it];
+        u32  stack_count   = 0;
+        bool has_back_edge = false;
+
+        // the header is marked first, so that the walk below stops there
+        in_loop[header] = header;
+        for (u32 pred = cfg->pred_start[header]; pred < cfg->pred_start[header + 1]; pred += 1) {
+            s32  source = cfg->preds[pred];
+            auto block  = &cfg->blocks[source];
+            if (block->idom == NO_BLOCK)            continue;
+            if (!dominates(cfg, header, source))    continue;
+
+            for (u32 edge = 0; edge < block->successor_count; edge += 1)
+                if (block->successors[edge].to == header)
+                    block->successors[edge].is_back_edge = true;
+
+            has_back_edge = true;
+            if (in_loop[source] != header) {
+                in_loop[source] = header;
+                stack[stack_count] = source;
+                stack_count += 1;
+            }
+        }
+        if (!has_back_edge)  continue;
+
+        auto loop = &cfg->loops[cfg->loop_count];
+        cfg->loop_count += 1;
+        loop->header = header;
+        cfg->blocks[header].is_loop_header = true;
+
+        while (stack_count) {
+            stack_count -= 1;
+            s32 block_index = stack[stack_count];
+
+            for (u32 pred = cfg->pred_start[block_index]; pred < cfg->pred_start[block_index + 1]; pred += 1) {
+                s32 source = cfg->preds[pred];
+                if (cfg->blocks[source].idom == NO_BLOCK || in_loop[source] == header)  continue;
+
+                in_loop[source] = header;
+                stack[stack_count] = source;
+                stack_count += 1;
+            }
+        }
+
+        for (u32 it = 0; it < cfg->block_count; it += 1) {
+            if (in_loop[it] != header)  continue;
+
+            loop->block_count += 1;
+            loop->clocks      += cfg->blocks[it].clocks;
+            cfg->blocks[it].loop_depth += 1;
+        }
+    }
+
+    free(in_loop);
+    free(stack);
+}
+
+void cfg_write_dot(Cfg *cfg, char *file_name) {
+    FILE *dot_file = 0;
+    if (fopen_s(&dot_file, file_name, "wb"))
+    {
+        printf("ERROR: File '%s' could not be opened.\n", file_name);
+        return;
+    }
+
+    fprintf(dot_file, "digraph cfg {\n");
+    fprintf(dot_file, "    node [shape=box, fontname=\"monospace\"];\n");
+
+    for (u32 it = 0; it < cfg->block_count; it += 1) {
+        auto block = &cfg->blocks[it];
+
+        if (block->is_exit) {
+            fprintf(dot_file, "    b%u [label=\"exit  0x%04x\", shape=ellipse%s];\n", it, block->first_address,
+                    (block->idom == NO_BLOCK) ? ", style=dashed" : "");
+            continue;
+        }
+
+        fprintf(dot_file, "    b%u [label=\"block %u  0x%04x\\l%u instructions, %u clocks",
+                it, it, block->first_address, block->instruction_count, block->clocks);
+        if (block->taken_clocks)
+            fprintf(dot_file, " (+%u taken)", block->taken_clocks);
+        if (block->loop_depth)
+            fprintf(dot_file, "\\lloop depth %u%s", block->loop_depth, block->is_loop_header ? ", header" : "");
+        if (block->idom == NO_BLOCK)
+            fprintf(dot_file, "\\lunreachable");
+        fprintf(dot_file, "\\l\\l");
+
+        for (u32 instruction = 0; instruction < block->instruction_count; instruction += 1) {
+            auto event = &cfg->instructions[block->first_instruction + instruction];
+
+            Trace_Line line;
+            line.at = line.data;
+            append_instruction(&line, event);
+            *line.at = 0;
+
+            fprintf(dot_file, "%04x  %s\\l", event->address, line.data);
+        }
+        fprintf(dot_file, "\"");
+
+        if (block->is_loop_header)
+            fprintf(dot_file, ", style=filled, fillcolor=\"#fff0c0\"");
+        else if (block->idom == NO_BLOCK)
+            fprintf(dot_file, ", style=dashed");
+        fprintf(dot_file, "];\n");
+    }
+
+    for (u32 it = 0; it < cfg->block_count; it += 1) {
+        auto block = &cfg->blocks[it];
+        for (u32 edge_index = 0; edge_index < block->successor_count; edge_index += 1) {
+            auto edge = &block->successors[edge_index];
+
+            char *label = "";
+            if      (edge->kind == EDGE_TAKEN) label = "taken";
+            else if (edge->kind == EDGE_CALL)  label = "call";
+
+            fprintf(dot_file, "    b%u -> b%d [label=\"%s\"", it, edge->to, label);
+            if (edge->kind == EDGE_CALL)
+                fprintf(dot_file, ", style=dashed");
+            if (edge->is_back_edge)
+                fprintf(dot_file, ", color=red, penwidth=2");
+            fprintf(dot_file, "];\n");
+        }
+    }
+
+    fprintf(dot_file, "}\n");
+    fclose(dot_file);
+}
+
+void cfg_report(Cfg *cfg, char *dot_file_name) {
+    u32 largest_block   = 0;
+    u32 block_count     = cfg->block_count;
+    u32 reachable_count = cfg->rpo_count;
+    for (u32 it = 0; it < cfg->block_count; it += 1)
+        if (cfg->blocks[it].instruction_count > largest_block)
+            largest_block = cfg->blocks[it].instruction_count;
+
+    // the exit block is not counted as a basic block
+    if (cfg->exit_block != NO_BLOCK) {
+        block_count -= 1;
+        if (cfg->blocks[cfg->exit_block].idom != NO_BLOCK)  reachable_count -= 1;
+    }
+
+    printf("; %u instructions in %u basic blocks (%u reachable), largest block %u instructions\n",
+           cfg->instruction_count, block_count, reachable_count, largest_block);
+
+    printf(";   block  address  instructions  clocks  taken  loop depth\n");
+    for (u32 it = 0; it < cfg->block_count; it += 1) {
+        auto block = &cfg->blocks[it];
+        printf(";   %5u  0x%04x   %12u  %6u  %5u  %10u%s%s\n", it, block->first_address, block->instruction_count,
+               block->clocks, block->taken_clocks, block->loop_depth,
+               block->is_exit ? "  exit" : "", (block->idom == NO_BLOCK) ? "  unreachable" : "");
+    }
+
+    printf("; %u natural loops\n", cfg->loop_count);
+    for (u32 it = 0; it < cfg->loop_count; it += 1) {
+        auto loop   = &cfg->loops[it];
+        auto header = &cfg->blocks[loop->header];
+        printf(";   header block %u (0x%04x): %u blocks, depth %u, %u clocks per pass\n",
+               loop->header, header->first_address, loop->block_count, header->loop_depth, loop->clocks);
+    }
+
+    printf("; CFG written to '%s'\n", dot_file_name);
+}
+
+void analyze_cfg(char *dot_file_name) {
+    Cfg cfg = {};
+
+    cfg_decode(&cfg);
+    cfg_build_blocks(&cfg);
+    cfg_find_dominators(&cfg);
+    cfg_find_loops(&cfg);
+
+    cfg_write_dot(&cfg, dot_file_name);
+    cfg_report(&cfg, dot_file_name);
+}
@@ -0,0 +1,278 @@
+// sim8086_profiler.cpp
+//
+// Built-in rdtsc profiler, the C++ twin of part2/part3 platform_metrics.jai.
+// Blocks nest: each one reports its cycles without children (exclusive) and
+// with them (inclusive), recursion included. Build with -DSIM86_PROFILER=1 to
+// enable it, otherwise every block compiles to nothing.
+//
+// The phases timed in the simulator are: decode (whatever execute_instruction
+// does outside the other blocks: decoding, dispatch, jumps), ea calc, exec,
+// flag update (nested in exec), formatting and biu timing. On top of that each
+// instruction is timed as a whole, and attributed to its instruction class.
+
+#ifndef SIM86_PROFILER
+#define SIM86_PROFILER 0
+#endif
+
+#define MAX_PROFILER_HOOKS 64 // index 0 is reserved
+
+// =========================================
+// OS
+//
+#include <psapi.h>
+#pragma comment(lib, "psapi.lib")
+
+struct Metrics_Data {
+    bool   initialized;
+    HANDLE process_handle;
+};
+
+static Metrics_Data metrics_data;
+
+u64 os_timer_frequency() {
+    LARGE_INTEGER frequency;
+    QueryPerformanceFrequency(&frequency);
+    return frequency.QuadPart;
+}
+
+u64 read_os_timer() {
+    LARGE_INTEGER value;
+    QueryPerformanceCounter(&value);
+    return value.QuadPart;
+}
+
+void initialize_os_metrics() {
+    if (metrics_data.initialized)  return;
+
+    metrics_data.initialized    = true;
+    metrics_data.process_handle = OpenProcess(PROCESS_QUERY_INFORMATION | PROCESS_VM_READ, FALSE, GetCurrentProcessId());
+}
+
+u64 read_os_page_fault_count() {
+    assert(metrics_data.initialized);
+
+    PROCESS_MEMORY_COUNTERS_EX counters = {};
+    counters.cb = sizeof(counters);
+    GetProcessMemoryInfo(metrics_data.process_handle, (PROCESS_MEMORY_COUNTERS *)&counters, counters.cb);
+
+    return counters.PageFaultCount;
+}
+
+inline u64 read_cpu_timer() {
+    return __rdtsc();
+}
+
+// returns: 0 if it was not able to estimate
+u64 estimate_cpu_frequency(u64 milliseconds_to_wait) {
+    u64 os_freq      = os_timer_frequency();
+    u64 os_wait_time = os_freq * milliseconds_to_wait / 1000;
+
+    u64 cpu_start  = read_cpu_timer();
+    u64 os_start   = read_os_timer();
+    u64 os_elapsed = 0;
+    while (os_elapsed < os_wait_time)
+        os_elapsed = read_os_timer() - os_start;
+
+    u64 cpu_elapsed = read_cpu_timer() - cpu_start;
+    if (!os_elapsed)  return 0;
+
+    return os_freq * cpu_elapsed / os_elapsed;
+}
+
+
+// =========================================
+// Instruction classes
+//
+enum Instruction_Class {
+    CLASS_MOV_REG_RM,        // mov register/memory to/from register
+    CLASS_ALU_REG_RM,        // add/sub/cmp register/memory with register
+    CLASS_MOV_IMMEDIATE_RM,  // mov immediate to register/memory
+    CLASS_ALU_IMMEDIATE_RM,  // add/sub/cmp immediate with register/memory
+    CLASS_MOV_IMMEDIATE_REG, // mov immediate to register
+    CLASS_MOV_ACCUMULATOR,   // mov memory to/from accumulator
+    CLASS_ALU_ACCUMULATOR,   // add/sub/cmp immediate with accumulator
+    CLASS_JUMP,
+    CLASS_LOOP,
+    CLASS_STACK,             // push, pop, pushf, popf
+    CLASS_CALL,              // call, ret
+    CLASS_UNKNOWN,
+
+    INSTRUCTION_CLASS_COUNT,
+};
+
+static char *instruction_class_names[] = {
+    "mov r/m, reg",
+    "alu r/m, reg",
+    "mov r/m, imm",
+    "alu r/m, imm",
+    "mov reg, imm",
+    "mov acc, mem",
+    "alu acc, imm",
+    "jcc",
+    "loop/jcxz",
+    "push/pop",
+    "call/ret",
+    "unknown",
+};
+
+// same opcode groups as execute_instruction
+// transfer: the instruction is a call or a return, 0xFF is both push and call
+Instruction_Class instruction_class(u8 instruction, bool transfer) {
+    if (transfer)                                     return CLASS_CALL;
+    if ((instruction >> 2) == 0b100010)               return CLASS_MOV_REG_RM;
+    if (((instruction >> 2) & 0b110001) == 0)         return CLASS_ALU_REG_RM;
+    if ((instruction >> 1) == 0b1100011)              return CLASS_MOV_IMMEDIATE_RM;
+    if ((instruction >> 2) == 0b100000)               return CLASS_ALU_IMMEDIATE_RM;
+    if ((instruction >> 4) == 0b1011)                 return CLASS_MOV_IMMEDIATE_REG;
+    if ((instruction >> 2) == 0b101000)               return CLASS_MOV_ACCUMULATOR;
+    if (((instruction >> 1) & 0b1100011) == 0b10)     return CLASS_ALU_ACCUMULATOR;
+    if ((instruction >> 4) == 0b0111)                 return CLASS_JUMP;
+    if ((instruction >> 4) == 0b0101)                 return CLASS_STACK;
+    if ((instruction == 0x8F) || (instruction == 0xFF)) return CLASS_STACK;
+    if ((instruction >> 1) == 0b1001110)              return CLASS_STACK;
+    if ((instruction >> 2) == 0b111000)               return CLASS_LOOP;
+    return CLASS_UNKNOWN;
+}
+
+
+// =========================================
+// Profiling
+//
+struct Profiler_Hook {
+    char *name;
+
+    u64 duration_exclusive; // without children
+    u64 duration_inclusive; // with    children
+
+    u64 byte_count;
+    u64 run_count;
+};
+
+struct Instruction_Class_Stats {
+    u64 run_count;
+    u64 duration;
+};
+
+static Profiler_Hook           profiler_hooks[MAX_PROFILER_HOOKS];
+static Instruction_Class_Stats profiler_classes[INSTRUCTION_CLASS_COUNT];
+static u64                     profiling_start;
+static u64                     profiling_page_faults;
+static u32                     profiler_open_hook;
+
+#if SIM86_PROFILER
+
+struct Profiler_Mark {
+    u32 hook_index;
+    u32 parent_hook_index;
+    u64 old_duration_inclusive;
+    u64 start_time;
+
+    Profiler_Mark(char *name, u32 index, u64 bytes = 0) {
+        auto hook = &profiler_hooks[index];
+        hook->name        = name;
+        hook->byte_count += bytes;
+
+        hook_index             = index;
+        parent_hook_index      = profiler_open_hook;
+        old_duration_inclusive = hook->duration_inclusive;
+
+        profiler_open_hook = index;
+        start_time = read_cpu_timer();
+    }
+
+    ~Profiler_Mark() {
+        u64 elapsed = read_cpu_timer() - start_time;
+
+        auto hook = &profiler_hooks[hook_index];
+        hook->duration_exclusive += elapsed;
+        hook->duration_inclusive  = old_duration_inclusive + elapsed;
+        hook->run_count          += 1;
+        profiler_hooks[parent_hook_index].duration_exclusive -= elapsed;
+
+        profiler_open_hook = parent_hook_index;
+    }
+};
+
+#define PROFILER_CONCAT_(a, b) a##b
+#define PROFILER_CONCAT(a, b)  PROFILER_CONCAT_(a, b)
+
+// each call site gets its own hook
+#define time_bandwidth(name, bytes) Profiler_Mark PROFILER_CONCAT(profiler_mark_, __LINE__)(name, __COUNTER__ + 1, bytes)
+#define time_block(name)            time_bandwidth(name, 0)
+#define time_function()             time_block(__FUNCTION__)
+
+inline u64 instruction_timer_start() {
+    return read_cpu_timer();
+}
+
+inline void instruction_timer_end(u8 instruction, bool transfer, u64 start_time) {
+    auto stats = &profiler_classes[instruction_class(instruction, transfer)];
+    stats->duration  += read_cpu_timer() - start_time;
+    stats->run_count += 1;
+}
+
+void start_profiling() {
+    initialize_os_metrics();
+    profiling_page_faults = read_os_page_fault_count();
+    profiling_start       = read_cpu_timer();
+}
+
+void end_and_report_profiling(u64 cpu_frequency) {
+    assert(profiling_start != 0);
+
+    u64 end         = read_cpu_timer();
+    u64 page_faults = read_os_page_fault_count() - profiling_page_faults;
+    f64 total_duration = (f64)(end - profiling_start);
+
+    printf("\n; Profile:\n");
+    if (cpu_frequency)
+        printf(";   total time: %.2fms (cpu frequency ~%llu MHz)\n", 1000.0 * total_duration / (f64)cpu_frequency, cpu_frequency / 1000000);
+    printf(";   total cycles: %.0f, page faults: %llu\n", total_duration, page_faults);
+
+    for (u32 it = 1; it < MAX_PROFILER_HOOKS; it += 1) {
+        auto hook = &profiler_hooks[it];
+        if (!hook->run_count)  continue;
+
+        f64 percentage = 100.0 * (f64)hook->duration_exclusive / total_duration;
+        printf(";   %-16s %10llu hits  %14llu cycles (%5.2f%%)", hook->name, hook->run_count, hook->duration_exclusive, percentage);
+
+        if (hook->duration_inclusive != hook->duration_exclusive) {
+            f64 as_root_percentage = 100.0 * (f64)hook->duration_inclusive / total_duration;
+            printf(" | w/children %llu (%.2f%%)", hook->duration_inclusive, as_root_percentage);
+        }
+
+        if (hook->byte_count && cpu_frequency) {
+            f64 seconds = (f64)hook->duration_inclusive / (f64)cpu_frequency;
+            f64 mib     = (f64)hook->byte_count / (1024.0 * 1024.0);
+            printf(" --- %.3fMiB (%.3f GiB/s)", mib, (mib / 1024.0) / seconds);
+        }
+
+        printf("\n");
+    }
+
+    u64 instruction_count = 0;
+    for (u32 it = 0; it < INSTRUCTION_CLASS_COUNT; it += 1)
+        instruction_count += profiler_classes[it].run_count;
+    if (!instruction_count)  return;
+
+    printf(";   class          executions         cycles  cycles/instruction\n");
+    for (u32 it = 0; it < INSTRUCTION_CLASS_COUNT; it += 1) {
+        auto stats = &profiler_classes[it];
+        if (!stats->run_count)  continue;
+
+        printf(";   %-12s  %10llu  %14llu  %18.1f\n", instruction_class_names[it], stats->run_count, stats->duration, (f64)stats->duration / (f64)stats->run_count);
+    }
+}
+
+#else // SIM86_PROFILER
+
+#define time_bandwidth(...)
+#define time_block(...)
+#define time_function(...)
+
+inline u64  instruction_timer_start()             { return 0; }
+inline void instruction_timer_end(u8, bool, u64)  {}
+inline void start_profiling()                     {}
+inline void end_and_report_profiling(u64)         {}
+
+#endif // SIM86_PROFILER
@@ -0,0 +1,344 @@
+// sim8086_timing.cpp
+//
+// Optional cycle-level timing: per-instruction EU clocks from the 8086 manual,
+// plus a model of the bus interface unit. The BIU prefetches instruction bytes
+// into a queue (6 bytes / 2 per bus cycle on the 8086, 4 bytes / 1 per bus cycle
+// on the 8088) whenever the bus is free, operand transfers compete with it for
+// the bus, and taken jumps flush the queue. Whatever the EU spends waiting for
+// the queue or for the bus is reported as stall clocks of that instruction.
+//
+// Simplifications: the EU needs every byte of an instruction before executing
+// it, reads happen right after the EA calculation and writes at the very end of
+// the instruction, and the 8086 always fetches a full word.
+
+#define BUS_CYCLE_CLOCKS 4
+
+enum Biu_Model {
+    BIU_OFF,
+    BIU_8086,
+    BIU_8088,
+};
+
+struct Biu_State {
+    u64 clock;          // end of the last instruction
+    u64 bus_free;       // end of the last bus cycle, prefetch or operand
+    u32 queue_bytes;
+    b32 queue_blocked;  // the BIU stopped because the queue was full
+
+    u32 queue_size;
+    u32 fetch_width;
+
+    u64 eu_clocks;
+    u64 stall_clocks;
+};
+
+struct Instruction_Timing_Stats {
+    char *text;
+    u64   executions;
+    u64   eu_clocks;
+    u64   stall_clocks;
+};
+
+static Biu_Model                biu_model;
+static Biu_State                biu;
+static Instruction_Timing_Stats biu_stats[0x10000]; // indexed by instruction address
+
+void biu_begin(Biu_Model model) {
+    biu_model = model;
+    biu       = {};
+    if (model == BIU_8088) {
+        biu.queue_size  = 4;
+        biu.fetch_width = 1;
+    } else {
+        biu.queue_size  = 6;
+        biu.fetch_width = 2;
+    }
+}
+
+// =========================================
+// EU clocks (8086 family user's manual, table 2-21)
+//
+struct Eu_Cost {
+    u32 clocks;        // including the effective address calculation
+    u32 ea_clocks;
+    u32 read_cycles;   // operand bus cycles
+    u32 write_cycles;
+};
+
+u32 effective_address_clocks(Memory_Pointer *memptr) {
+    if (!memptr->addend_0)  return 6; // displacement only
+
+    u32 result;
+    if (!memptr->addend_1) {
+        result = 5;
+    } else {
+        // bp + di and bx + si are one clock faster than bp + si and bx + di
+        bool fast_pair = ((memptr->addend_0->index == bp) && (memptr->addend_1->index == di)) ||
+                         ((memptr->addend_0->index == bx) && (memptr->addend_1->index == si));
+        result = fast_pair ? 7 : 8;
+    }
+
+    if (memptr->has_displacement)
+        result += 4;
+
+    return result;
+}
+
+// a word transfer costs a second bus cycle on the 8088, and on the 8086 when the address is odd
+u32 transfer_cycles(Trace_Operand *operand) {
+    u32 num_bytes = (operand->kind == OPERAND_MEMORY) ? operand->memory_pointer.num_bytes : operand->access_bytes;
+    if (num_bytes == 1)  return 1;
+
+    if ((biu_model == BIU_8088) || (operand->effective_address & 1))
+        return 2;
+
+    return 1;
+}
+
+// push, pop, pushf, popf, call and ret: one word on the stack plus the r/m operand, if any
+Eu_Cost stack_cost(Trace_Event *event, Trace_Operand *memory_operand) {
+    Eu_Cost result = {};
+
+    u8 instruction = event->instruction;
+    if (memory_operand)
+        result.ea_clocks = effective_address_clocks(&memory_operand->memory_pointer);
+
+    if      ((instruction >> 3) == 0b01010) result.clocks = 11;                         // push reg
+    else if ((instruction >> 3) == 0b01011) result.clocks = 8;                          // pop reg
+    else if (instruction == 0x9C)           result.clocks = 10;                         // pushf
+    else if (instruction == 0x9D)           result.clocks = 8;                          // popf
+    else if (instruction == 0xE8)           result.clocks = 19;                         // call near
+    else if (instruction == 0xC3)           result.clocks = 8;                          // ret
+    else if (instruction == 0xC2)           result.clocks = 12;                         // ret imm
+    else if (instruction == 0x8F)           result.clocks = memory_operand ? 17 : 8;    // pop r/m
+    else if (event->transfer == TRANSFER_CALL) result.clocks = memory_operand ? 21 : 16; // call r/m
+    else                                    result.clocks = memory_operand ? 16 : 11;   // push r/m
+
+    // sp moves by words, it stays odd or even
+    u32 stack_cycles  = ((biu_model == BIU_8088) || (event->prev_sp & 1)) ? 2 : 1;
+    u32 memory_cycles = memory_operand ? transfer_cycles(memory_operand) : 0;
+    if (event->stack == STACK_PUSH) {
+        result.write_cycles = stack_cycles;
+        result.read_cycles  = memory_cycles;
+    } else {
+        result.read_cycles  = stack_cycles;
+        result.write_cycles = memory_cycles;
+    }
+
+    result.clocks += result.ea_clocks;
+    result.clocks += (stack_cycles - 1) * BUS_CYCLE_CLOCKS;
+    if (memory_cycles)
+        result.clocks += (memory_cycles - 1) * BUS_CYCLE_CLOCKS;
+
+    return result;
+}
+
+Eu_Cost eu_cost(Trace_Event *event) {
+    Eu_Cost result = {};
+
+    u8 instruction = event->instruction;
+    if (event->kind != TRACE_INSTRUCTION)
+        return result;
+
+    Trace_Operand *memory_operand = 0;
+    bool           memory_is_dest = false;
+    if (event->dest.kind == OPERAND_MEMORY || event->dest.kind == OPERAND_DIRECT_ADDRESS) {
+        memory_operand = &event->dest;
+        memory_is_dest = true;
+    }
+    else if (event->source.kind == OPERAND_MEMORY || event->source.kind == OPERAND_DIRECT_ADDRESS) {
+        memory_operand = &event->source;
+    }
+
+    bool is_mov = (instruction >> 2) == 0b100010 || (instruction >> 1) == 0b1100011 ||
+                  (instruction >> 4) == 0b1011   || (instruction >> 2) == 0b101000;
+    bool is_cmp = event->text == op_names[OP_CMP];
+
+    if (event->stack != STACK_NONE)
+        return stack_cost(event, memory_operand);
+
+    if ((instruction >> 4) == 0b0111) {                 // jcc
+        result.clocks = event->taken ? 16 : 4;
+    }
+    else if ((instruction >> 4) == 0b1110) {            // loops
+        u8 loop_code = instruction & 0b1111;
+        if      (loop_code == 0b0010) result.clocks = event->taken ? 17 : 5;  // loop
+        else if (loop_code == 0b0001) result.clocks = event->taken ? 18 : 6;  // loopz
+        else if (loop_code == 0b0000) result.clocks = event->taken ? 19 : 5;  // loopnz
+        else                          result.clocks = event->taken ? 18 : 6;  // jcxz
+    }
+    else if ((instruction >> 2) == 0b101000) {          // accumulator to/from memory
+        result.clocks = 10;
+        if (memory_is_dest) result.write_cycles = 1;
+        else                result.read_cycles  = 1;
+    }
+    else if (!memory_operand) {
+        bool immediate = (event->source.kind == OPERAND_IMMEDIATE) || (event->source.kind == OPERAND_IMMEDIATE_UNSIGNED);
+        if (immediate)   result.clocks = 4;
+        else if (is_mov) result.clocks = 2;
+        else             result.clocks = 3;
+    }
+    else {
+        bool immediate = (event->source.kind == OPERAND_IMMEDIATE) || (event->source.kind == OPERAND_IMMEDIATE_UNSIGNED);
+        result.ea_clocks = effective_address_clocks(&memory_operand->memory_pointer);
+
+        if (is_mov) {
+            if (immediate)           { result.clocks = 10; result.write_cycles = 1; }
+            else if (memory_is_dest) { result.clocks =  9; result.write_cycles = 1; }
+            else                     { result.clocks =  8; result.read_cycles  = 1; }
+        }
+        else if (is_cmp || !memory_is_dest) {
+            result.clocks      = immediate ? 10 : 9;
+            result.read_cycles = 1;
+        }
+        else {
+            result.clocks       = immediate ? 17 : 16;
+            result.read_cycles  = 1;
+            result.write_cycles = 1;
+        }
+        result.clocks += result.ea_clocks;
+    }
+
+    if (memory_operand) {
+        // the extra cycle of a word transfer is not part of the base clocks
+        u32 transfers           = result.read_cycles + result.write_cycles;
+        u32 cycles_per_transfer = transfer_cycles(memory_operand);
+        result.clocks       += transfers * (cycles_per_transfer - 1) * BUS_CYCLE_CLOCKS;
+        result.read_cycles  *= cycles_per_transfer;
+        result.write_cycles *= cycles_per_transfer;
+    }
+
+    return result;
+}
+
+
+// =========================================
+// BIU
+//
+
+// runs every prefetch that completes by time
+void biu_prefetch_until(u64 time) {
+    while (!biu.queue_blocked) {
+        if (biu.queue_bytes + biu.fetch_width > biu.queue_size) {
+            biu.queue_blocked = true;
+            break;
+        }
+        if (biu.bus_free + BUS_CYCLE_CLOCKS > time)
+            break;
+
+        biu.bus_free    += BUS_CYCLE_CLOCKS;
+        biu.queue_bytes += biu.fetch_width;
+    }
+}
+
+// the EU took bytes out of the queue at time, a blocked BIU can resume from there
+void biu_consumed(u64 time) {
+    if (biu.queue_blocked && (biu.queue_bytes + biu.fetch_width <= biu.queue_size)) {
+        biu.queue_blocked = false;
+        if (biu.bus_free < time)
+            biu.bus_free = time;
+    }
+}
+
+// returns: the time at which every byte of the instruction is available to the EU
+u64 biu_fetch_instruction(u64 time, u32 size) {
+    u32 remaining = size;
+    for (;;) {
+        biu_prefetch_until(time);
+
+        u32 take = (biu.queue_bytes < remaining) ? biu.queue_bytes : remaining;
+        biu.queue_bytes -= take;
+        remaining       -= take;
+        biu_consumed(time);
+
+        if (!remaining)  break;
+
+        // queue is empty: wait for the prefetch in flight (started at bus_free), or the next one
+        biu.bus_free    += BUS_CYCLE_CLOCKS;
+        biu.queue_bytes += biu.fetch_width;
+        time = biu.bus_free;
+    }
+
+    return time;
+}
+
+// returns: the time at which the EU got the bus for the operand transfer
+u64 biu_operand_transfer(u64 time, u32 cycles) {
+    biu_prefetch_until(time);
+
+    // a prefetch cycle that already started has to complete first
+    if (!biu.queue_blocked && (biu.bus_free < time)) {
+        biu.bus_free    += BUS_CYCLE_CLOCKS;
+        biu.queue_bytes += biu.fetch_width;
+    }
+
+    u64 start = (biu.bus_free > time) ? biu.bus_free : time;
+    biu.bus_free = start + cycles * BUS_CYCLE_CLOCKS;
+    return start;
+}
+
+void biu_time_instruction(Trace_Event *event) {
+    time_block("biu timing");
+
+    u64 start = biu.clock;
+
+    u64     ready = biu_fetch_instruction(start, event->size);
+    Eu_Cost cost  = eu_cost(event);
+
+    u64 stall = ready - start;
+    u64 time  = ready;
+
+    if (cost.read_cycles) {
+        u64 request = time + cost.ea_clocks;
+        u64 granted = biu_operand_transfer(request, cost.read_cycles);
+        stall += granted - request;
+        time  += granted - request;
+    }
+    if (cost.write_cycles) {
+        u64 request = time + cost.clocks - cost.write_cycles * BUS_CYCLE_CLOCKS;
+        u64 granted = biu_operand_transfer(request, cost.write_cycles);
+        stall += granted - request;
+        time  += granted - request;
+    }
+
+    time += cost.clocks;
+
+    if (event->taken) {
+        // flush: the queue refills from the jump target once the bus is free
+        biu.queue_bytes   = 0;
+        biu.queue_blocked = false;
+        if (biu.bus_free < time)
+            biu.bus_free = time;
+    }
+
+    biu.clock         = time;
+    biu.eu_clocks    += cost.clocks;
+    biu.stall_clocks += stall;
+
+    event->timed        = true;
+    event->clocks       = (u32)(time - start);
+    event->stall_clocks = (u32)stall;
+    event->total_clocks = time;
+
+    auto stats = &biu_stats[event->address];
+    stats->text          = event->text;
+    if (event->kind != TRACE_INSTRUCTION)
+        stats->text = "unknown";
+    stats->executions   += 1;
+    stats->eu_clocks    += cost.clocks;
+    stats->stall_clocks += stall;
+}
+
+void biu_report() {
+    if (biu_model == BIU_OFF)  return;
+
+    printf("\n; BIU timing (%s, %u-byte prefetch queue):\n", (biu_model == BIU_8088) ? "8088" : "8086", biu.queue_size);
+    printf(";   total clocks: %llu (eu %llu, stall %llu)\n", biu.clock, biu.eu_clocks, biu.stall_clocks);
+    printf(";   address  instruction  executions    eu clocks  stall clocks\n");
+    for (u32 it = 0; it < arr_len(biu_stats); it += 1) {
+        auto stats = &biu_stats[it];
+        if (!stats->executions)  continue;
+
+        printf(";   0x%04x   %-11s  %10llu  %11llu  %12llu\n", it, stats->text, stats->executions, stats->eu_clocks, stats->stall_clocks);
+    }
+}
@@ -0,0 +1,462 @@
+// sim8086_trace.cpp
+//
+// Text tracing. The execute loop never formats: every instruction fills a
+// fixed-size Trace_Event that is either formatted right away (serial) or pushed
+// into a single-producer/single-consumer ring that a second thread drains, so
+// simulation and formatting overlap on two cores. Both paths print the same text.
+
+enum Trace_Kind {
+    TRACE_INSTRUCTION,
+    TRACE_UNKNOWN_OP,   // valid opcode group, unsupported operation
+    TRACE_UNKNOWN,      // unknown opcode
+};
+
+// what follows the instruction text on the same line
+enum Trace_Suffix {
+    SUFFIX_NONE,
+    SUFFIX_OP,            // "; dest:prev -> curr  ip  [flags]"
+    SUFFIX_MOV_IMMEDIATE, // "; reg:prev -> curr  ip" (mov immediate to register)
+    SUFFIX_JUMP,          // "; ip"
+    SUFFIX_STACK,         // "; sp:prev -> curr  ip  [flags]" (push, call, ret, popf)
+    SUFFIX_POP,           // "; dest:prev -> curr  sp:prev -> curr  ip"
+};
+
+enum Trace_Stack {
+    STACK_NONE,
+    STACK_PUSH,   // push, pushf, call
+    STACK_POP,    // pop, popf, ret
+};
+
+enum Trace_Transfer {
+    TRANSFER_NONE,
+    TRANSFER_CALL,
+    TRANSFER_RETURN,
+};
+
+enum Trace_Operand_Kind {
+    OPERAND_NONE,
+    OPERAND_REGISTER,
+    OPERAND_MEMORY,
+    OPERAND_IMMEDIATE,           // %d
+    OPERAND_IMMEDIATE_UNSIGNED,  // %u
+    OPERAND_DIRECT_ADDRESS,      // [%d]
+    OPERAND_RELATIVE,            // $%+d
+};
+
+struct Trace_Operand {
+    Trace_Operand_Kind kind;
+    u16                effective_address; // memory operands, computed before the instruction executed
+    u8                 access_bytes;      // direct addresses: 1 or 2, the w bit of the instruction
+    union {
+        Register_Pointer *register_pointer;
+        Memory_Pointer    memory_pointer;
+        s32               immediate;
+    };
+};
+
+struct Trace_Event {
+    Trace_Kind     kind;
+    Trace_Suffix   suffix;
+    u16            address;       // ip of the first byte
+    u8             size;
+    u8             instruction;   // first opcode byte
+    bool           taken;         // jumps, calls and returns
+    Trace_Stack    stack;
+    Trace_Transfer transfer;
+    char          *text;          // mnemonic, or the opcode group for TRACE_UNKNOWN_OP
+    Trace_Operand  dest;
+    Trace_Operand  source;
+
+    // what print_op used to receive, plus the state it read
+    bool           print_flags;
+    u16            prev_data;
+    u16            curr_data;
+    u16            prev_flags;
+    u16            curr_flags;
+    u16            ip;
+    u16            prev_sp;
+    u16            curr_sp;
+
+    // BIU timing, see sim8086_timing.cpp
+    bool           timed;
+    u32            clocks;        // since the end of the previous instruction
+    u32            stall_clocks;
+    u64            total_clocks;
+};
+
+inline Trace_Operand trace_register(Register_Pointer *register_pointer) {
+    Trace_Operand result = {};
+    result.kind             = OPERAND_REGISTER;
+    result.register_pointer = register_pointer;
+    return result;
+}
+
+inline Trace_Operand trace_memory(Memory_Pointer *memory_pointer) {
+    Trace_Operand result = {};
+    result.kind              = OPERAND_MEMORY;
+    result.memory_pointer    = *memory_pointer;
+    result.effective_address = calc_effective_address(memory_pointer);
+    return result;
+}
+
+inline Trace_Operand trace_immediate(Trace_Operand_Kind kind, s32 immediate) {
+    Trace_Operand result = {};
+    result.kind      = kind;
+    result.immediate = immediate;
+    if (kind == OPERAND_DIRECT_ADDRESS) {
+        result.effective_address = (u16)immediate;
+        result.access_bytes      = 2;
+    }
+    return result;
+}
+
+inline void trace_effect(Trace_Event *event, Trace_Suffix suffix, u16 curr_data, u16 prev_data, bool print_flags = false, u16 prev_flags = 0) {
+    event->suffix      = suffix;
+    event->curr_data   = curr_data;
+    event->prev_data   = prev_data;
+    event->print_flags = print_flags;
+    event->prev_flags  = prev_flags;
+    event->curr_flags  = flags_register;
+    event->ip          = registers[ip];
+    event->curr_sp     = registers[sp];
+}
+
+struct Trace_Line {
+    char  data[256]; // longest line, flags and clocks included, is well under this
+    char *at;
+};
+
+// hand-rolled instead of sprintf: the formatting thread has to keep up with the simulation
+inline void append(Trace_Line *line, char *str) {
+    while (*str) {
+        *line->at = *str;
+        line->at += 1;
+        str      += 1;
+    }
+}
+
+void append_u64(Trace_Line *line, u64 value) {
+    char digits[20];
+    int  count = 0;
+    do {
+        digits[count] = (char)('0' + (value % 10));
+        value /= 10;
+        count += 1;
+    } while (value);
+
+    while (count) {
+        count -= 1;
+        *line->at = digits[count];
+        line->at += 1;
+    }
+}
+
+inline void append_u32(Trace_Line *line, u32 value) {
+    append_u64(line, value);
+}
+
+void append_s32(Trace_Line *line, s32 value, bool force_sign = false) {
+    if (value < 0) {
+        append(line, "-");
+        append_u32(line, 0u - (u32)value);
+        return;
+    }
+
+    if (force_sign)  append(line, "+");
+    append_u32(line, (u32)value);
+}
+
+void append_hex(Trace_Line *line, u32 value, int min_digits = 1) {
+    static char hex_digits[] = "0123456789abcdef";
+
+    int digit_count = 1;
+    while ((value >> (4*digit_count)) && (digit_count < 8))  digit_count += 1;
+    if (digit_count < min_digits)  digit_count = min_digits;
+
+    for (int it = digit_count - 1; it >= 0; it -= 1) {
+        *line->at = hex_digits[(value >> (4*it)) & 0xF];
+        line->at += 1;
+    }
+}
+
+// same text as to_string(Memory_Pointer *)
+void append(Trace_Line *line, Memory_Pointer *memptr) {
+    if (memptr->num_bytes == 1) append(line, "byte [");
+    else                        append(line, "word [");
+    if (memptr->addend_0) {
+        append(line, memptr->addend_0->name);
+        append(line, " + ");
+    }
+    if (memptr->addend_1) {
+        append(line, memptr->addend_1->name);
+        append(line, " + ");
+    }
+    append_s32(line, memptr->address);
+    append(line, "]");
+}
+
+void append(Trace_Line *line, Trace_Operand *operand) {
+    switch (operand->kind) {
+        case OPERAND_NONE: break;
+        case OPERAND_REGISTER:           append(line, operand->register_pointer->name);     break;
+        case OPERAND_MEMORY:             append(line, &operand->memory_pointer);            break;
+        case OPERAND_IMMEDIATE:          append_s32(line, operand->immediate);              break;
+        case OPERAND_IMMEDIATE_UNSIGNED: append_u32(line, (u32)operand->immediate);         break;
+        case OPERAND_DIRECT_ADDRESS: {
+            append(line, "[");
+            append_s32(line, operand->immediate);
+            append(line, "]");
+        } break;
+        case OPERAND_RELATIVE: {
+            append(line, "$");
+            append_s32(line, operand->immediate, true);
+        } break;
+    }
+}
+
+// "mnemonic dest, source"
+void append_instruction(Trace_Line *line, Trace_Event *event) {
+    if (event->kind != TRACE_INSTRUCTION) {
+        append(line, "unknown 0x");
+        append_hex(line, event->instruction, 2);
+        return;
+    }
+
+    append(line, event->text);
+    if (event->dest.kind   != OPERAND_NONE) {
+        append(line, " ");
+        append(line, &event->dest);
+    }
+    if (event->source.kind != OPERAND_NONE) {
+        append(line, ", ");
+        append(line, &event->source);
+    }
+}
+
+// builds the whole line first, so that each instruction costs a single write to stdout
+void print_trace_event(Trace_Event *event) {
+    time_block("formatting");
+
+    if (event->kind == TRACE_UNKNOWN) {
+        printf("unknown: %x    ", event->instruction);
+        print_binary(event->instruction);
+        printf("\n");
+        return;
+    }
+
+    if (event->kind == TRACE_UNKNOWN_OP) {
+        printf("unknown op: %s   --> ", event->text);
+        print_binary(event->instruction);
+        printf("\n");
+        return;
+    }
+
+    Trace_Line line;
+    line.at = line.data;
+
+    append_instruction(&line, event);
+
+    switch (event->suffix) {
+        case SUFFIX_NONE: break;
+
+        case SUFFIX_OP: {
+            append(&line, "\t; ");
+            append(&line, &event->dest);
+            append(&line, ":0x");
+            append_hex(&line, event->prev_data, 4);
+            append(&line, " -> 0x");
+            append_hex(&line, event->curr_data, 4);
+
+            append(&line, "\tip:0x");
+            append_hex(&line, event->ip);
+
+            if (event->print_flags) {
+                char curr_flags_str[FLAGS_COUNT + 1] = {};
+                char prev_flags_str[FLAGS_COUNT + 1] = {};
+
+                fill_flags_string(event->curr_flags, curr_flags_str);
+                fill_flags_string(event->prev_flags, prev_flags_str);
+                append(&line, "\tflags: ");
+                append(&line, prev_flags_str);
+                append(&line, " -> ");
+                append(&line, curr_flags_str);
+            }
+        } break;
+
+        case SUFFIX_MOV_IMMEDIATE: {
+            append(&line, "   \t; ");
+            append(&line, &event->dest);
+            append(&line, ":0x");
+            append_hex(&line, event->prev_data, 4);
+            append(&line, " -> 0x");
+            append_hex(&line, event->curr_data, 4);
+            append(&line, "\tip:0x");
+            append_hex(&line, event->ip, 4);
+        } break;
+
+        case SUFFIX_JUMP: {
+            append(&line, "  \t; ip:0x");
+            append_hex(&line, event->ip);
+        } break;
+
+        case SUFFIX_STACK:
+        case SUFFIX_POP: {
+            append(&line, "\t; ");
+            if (event->suffix == SUFFIX_POP) {
+                append(&line, &event->dest);
+                append(&line, ":0x");
+                append_hex(&line, event->prev_data, 4);
+                append(&line, " -> 0x");
+                append_hex(&line, event->curr_data, 4);
+                append(&line, "\t");
+            }
+
+            append(&line, "sp:0x");
+            append_hex(&line, event->prev_sp, 4);
+            append(&line, " -> 0x");
+            append_hex(&line, event->curr_sp, 4);
+
+            append(&line, "\tip:0x");
+            append_hex(&line, event->ip);
+
+            if (event->print_flags) {
+                char curr_flags_str[FLAGS_COUNT + 1] = {};
+                char prev_flags_str[FLAGS_COUNT + 1] = {};
+
+                fill_flags_string(event->curr_flags, curr_flags_str);
+                fill_flags_string(event->prev_flags, prev_flags_str);
+                append(&line, "\tflags: ");
+                append(&line, prev_flags_str);
+                append(&line, " -> ");
+                append(&line, curr_flags_str);
+            }
+        } break;
+    }
+
+    if (event->timed) {
+        append(&line, "\tclocks: +");
+        append_u32(&line, event->clocks);
+        append(&line, " = ");
+        append_u64(&line, event->total_clocks);
+        if (event->stall_clocks) {
+            append(&line, " (stall ");
+            append_u32(&line, event->stall_clocks);
+            append(&line, ")");
+        }
+    }
+
+    append(&line, "\n");
+    fwrite(line.data, 1, line.at - line.data, stdout);
+}
+
+
+// =========================================
+// SPSC ring
+//
+#define TRACE_RING_SIZE 4096 // must be a power of two
+#define TRACE_RING_MASK (TRACE_RING_SIZE - 1)
+#define TRACE_SPINS_BEFORE_YIELD 1024
+
+#pragma warning(push)
+#pragma warning(disable: 4324) // structure was padded due to alignment specifier, the padding is the point
+
+struct Trace_Ring {
+    Trace_Event events[TRACE_RING_SIZE];
+
+    // each index is written by one thread only, keep them on separate cache lines
+    alignas(64) volatile u64 write_index;
+    alignas(64) volatile u64 read_index;
+    alignas(64) volatile b32 done;
+};
+
+#pragma warning(pop)
+
+enum Trace_Mode {
+    TRACE_OFF,
+    TRACE_SERIAL,    // format inline, on the simulation thread
+    TRACE_PIPELINED, // format on a second thread
+};
+
+static Trace_Mode trace_mode = TRACE_PIPELINED;
+static Trace_Ring trace_ring;
+static HANDLE     trace_thread;
+
+DWORD WINAPI trace_thread_proc(LPVOID) {
+    u32 idle_spins = 0;
+    for (;;) {
+        u64 read  = trace_ring.read_index;
+        u64 write = trace_ring.write_index;
+
+        if (read == write) {
+            // done is set after the last write, so re-check the index once it is seen
+            if (trace_ring.done && (read == trace_ring.write_index))  break;
+
+            idle_spins += 1;
+            if (idle_spins >= TRACE_SPINS_BEFORE_YIELD) {
+                idle_spins = 0;
+                SwitchToThread();
+            }
+            else
+                _mm_pause();
+            continue;
+        }
+        idle_spins = 0;
+
+        _ReadWriteBarrier();
+        while (read < write) {
+            print_trace_event(&trace_ring.events[read & TRACE_RING_MASK]);
+            read += 1;
+
+            _ReadWriteBarrier();
+            trace_ring.read_index = read;
+        }
+    }
+
+    return 0;
+}
+
+void trace_begin() {
+    if (trace_mode != TRACE_PIPELINED)  return;
+
+    trace_thread = CreateThread(0, 0, trace_thread_proc, 0, 0, 0);
+    if (!trace_thread)
+        trace_mode = TRACE_SERIAL;
+}
+
+inline void trace_push(Trace_Event *event) {
+    if (trace_mode == TRACE_OFF)  return;
+
+    if (trace_mode == TRACE_SERIAL) {
+        print_trace_event(event);
+        return;
+    }
+
+    u64 write      = trace_ring.write_index;
+    u32 full_spins = 0;
+    while ((write - trace_ring.read_index) >= TRACE_RING_SIZE) {
+        full_spins += 1;
+        if (full_spins >= TRACE_SPINS_BEFORE_YIELD) {
+            full_spins = 0;
+            SwitchToThread();
+        }
+        else
+            _mm_pause();
+    }
+
+    trace_ring.events[write & TRACE_RING_MASK] = *event;
+
+    _ReadWriteBarrier();
+    trace_ring.write_index = write + 1;
+}
+
+// waits for every pushed event to be printed
+void trace_end() {
+    if (trace_mode != TRACE_PIPELINED)  return;
+
+    _ReadWriteBarrier();
+    trace_ring.done = true;
+
+    WaitForSingleObject(trace_thread, INFINITE);
+    CloseHandle(trace_thread);
+    trace_thread = 0;
+}
@@ -0,0 +1,568 @@
+// sim8086_wide.cpp
+//
+// Parameter sweeps: runs the same image for many instances that only differ in
+// their initial registers. Sixteen instances (lanes) run in lockstep with the
+// registers and flags stored as structure-of-arrays, one 16-bit lane per
+// instance in an AVX2 register. Every instruction is decoded once, by the
+// regular handlers in decode_only mode, and applied to all the lanes that sit
+// at its address. Lanes that diverge on a conditional jump are masked out:
+// each step runs the lowest ip among the lanes still running, so the lanes
+// behind catch up and join the others again once they reach the same code.
+//
+// Register operations are vectorized. Memory operands go lane by lane, each
+// lane has its own 64k of memory. Semantics follow the scalar handlers
+// exactly, quirks included, so -scalar runs the same sweep one instance at a
+// time with execute_instruction and prints the same results.
+
+#define WIDE_LANES         16
+#define WIDE_MEMORY_STRIDE (0x10000 + 16) // a word write at 0xFFFF stays in the lane
+#define WIDE_MAX_SWEEPS    REGISTER_COUNT
+
+enum Wide_Action {
+    WIDE_SKIP,           // decoded only, the scalar handlers do not execute it either
+    WIDE_OP,             // mov/add/sub/cmp on a register or memory destination
+    WIDE_MOV_IMMEDIATE,  // mov immediate to register
+    WIDE_JUMP,
+    WIDE_STACK,          // push, pop, pushf, popf, call, ret; lane by lane
+};
+
+struct Wide_Instruction {
+    Trace_Event event;
+    Wide_Action action;
+    Decoded_Op  op;
+};
+
+struct Wide_Machine {
+    alignas(32) u16 registers[REGISTER_COUNT][WIDE_LANES];
+    alignas(32) u16 flags[WIDE_LANES];
+    u8              memory[WIDE_LANES][WIDE_MEMORY_STRIDE];
+};
+
+struct Wide_Sweep {
+    Register_Index reg;
+    u16            start;
+    u16            step;
+};
+
+struct Wide_Stats {
+    u64 steps;              // instructions dispatched
+    u64 lane_instructions;  // instructions executed, summed over lanes
+};
+
+static Wide_Instruction wide_decode_cache[0x10000];
+static bool             wide_decoded[0x10000];
+static Wide_Sweep       wide_sweeps[WIDE_MAX_SWEEPS];
+static u32              wide_sweep_count;
+static Wide_Stats       wide_stats;
+static Wide_Machine     wide_machine;
+
+// returns: false if reg_name is not a 16-bit register or if there are too many sweeps
+bool wide_add_sweep(char *reg_name, u16 start, u16 step) {
+    if (wide_sweep_count >= WIDE_MAX_SWEEPS)  return false;
+
+    for (u32 it = 0b1000; it < arr_len(register_pointer_table); it += 1) {
+        if (strcmp(register_pointer_table[it].name, reg_name) != 0)  continue;
+
+        auto sweep   = &wide_sweeps[wide_sweep_count];
+        sweep->reg   = register_pointer_table[it].index;
+        sweep->start = start;
+        sweep->step  = step;
+        wide_sweep_count += 1;
+        return true;
+    }
+
+    return false;
+}
+
+inline u16 wide_initial_value(Register_Index reg, u32 instance) {
+    u16 result = 0;
+    for (u32 it = 0; it < wide_sweep_count; it += 1) {
+        if (wide_sweeps[it].reg == reg)
+            result = (u16)(wide_sweeps[it].start + instance * wide_sweeps[it].step);
+    }
+    return result;
+}
+
+// the cpu has to support AVX2 and the OS has to save the ymm registers
+bool cpu_has_avx2() {
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7)  return false;
+
+    __cpuid(info, 1);
+    bool osxsave = (info[2] >> 27) & 1; // ecx bit 27
+    bool avx     = (info[2] >> 28) & 1; // ecx bit 28
+    if (!osxsave || !avx)  return false;
+
+    // XCR0: xmm (bit 1) and ymm (bit 2) state enabled
+    if ((_xgetbv(0) & 6) != 6)  return false;
+
+    __cpuidex(info, 7, 0);
+    return (info[1] >> 5) & 1; // ebx bit 5
+}
+
+
+// =========================================
+// Decoding
+//
+Wide_Instruction *wide_fetch(u16 address) {
+    auto instruction = &wide_decode_cache[address];
+    if (wide_decoded[address])  return instruction;
+
+    instruction_pointer = instruction_start + address;
+    registers[ip]       = address;
+
+    *instruction = {};
+    decode_only = true;
+    execute_instruction(&instruction->event);
+    decode_only = false;
+
+    auto event = &instruction->event;
+    u8   first = event->instruction;
+    if (event->kind != TRACE_INSTRUCTION) {
+        instruction->action = WIDE_SKIP;
+    }
+    else if (event->stack != STACK_NONE) {
+        instruction->action = WIDE_STACK;
+    }
+    else if ((first >> 4) == 0b0111) {
+        instruction->action = WIDE_JUMP;
+    }
+    else if ((first >> 4) == 0b1011) {
+        instruction->action = WIDE_MOV_IMMEDIATE;
+    }
+    else if (((first >> 2) == 0b100010) || (((first >> 2) & 0b110001) == 0) ||
+             ((first >> 1) == 0b1100011) || ((first >> 2) == 0b100000)) {
+        instruction->action = WIDE_OP;
+
+        instruction->op = OP_MOV;
+        for (u32 op = OP_ADD; op < OP_UNKNOWN; op += 1) {
+            if (event->text == op_names[op])
+                instruction->op = (Decoded_Op)op;
+        }
+    }
+    else {
+        instruction->action = WIDE_SKIP; // accumulator forms, loops
+    }
+
+    wide_decoded[address] = true;
+    return instruction;
+}
+
+
+// =========================================
+// Lane helpers
+//
+inline __m256i wide_load(u16 *lanes) {
+    return _mm256_load_si256((__m256i *)lanes);
+}
+
+inline void wide_store(u16 *lanes, __m256i value) {
+    _mm256_store_si256((__m256i *)lanes, value);
+}
+
+inline __m256i wide_shift_right(__m256i value, u32 count) {
+    return _mm256_srl_epi16(value, _mm_cvtsi32_si128(count));
+}
+
+inline __m256i wide_shift_left(__m256i value, u32 count) {
+    return _mm256_sll_epi16(value, _mm_cvtsi32_si128(count));
+}
+
+// 0 or 1 in each lane
+inline __m256i wide_flag(__m256i flags, Flags flag) {
+    return _mm256_and_si256(wide_shift_right(flags, flag), _mm256_set1_epi16(1));
+}
+
+inline u16 wide_effective_address(Wide_Machine *machine, Memory_Pointer *memptr, u32 lane) {
+    u64 mem_address = memptr->address;
+    if (memptr->addend_0)
+        mem_address += machine->registers[memptr->addend_0->index][lane];
+    if (memptr->addend_1)
+        mem_address += machine->registers[memptr->addend_1->index][lane];
+
+    assert(mem_address <= 0xFFFF);
+    return (u16)mem_address;
+}
+
+u16 wide_read_memory(Wide_Machine *machine, Memory_Pointer *memptr, u32 lane) {
+    u8 *lane_memory = machine->memory[lane];
+    u16 address     = wide_effective_address(machine, memptr, lane);
+
+    u16 mem_data = lane_memory[address];
+    if (memptr->num_bytes > 1)
+        mem_data |= lane_memory[address + 1] << 8;
+
+    return mem_data;
+}
+
+// stack words wrap around the 64k, like push_word and pop_word
+void wide_push_word(Wide_Machine *machine, u32 lane, u16 data) {
+    machine->registers[sp][lane] -= 2;
+
+    u16 address = machine->registers[sp][lane];
+    machine->memory[lane][address]            = (u8)(data);
+    machine->memory[lane][(u16)(address + 1)] = (u8)(data >> 8);
+}
+
+u16 wide_pop_word(Wide_Machine *machine, u32 lane) {
+    u16 address = machine->registers[sp][lane];
+    u16 data    = machine->memory[lane][address] | (machine->memory[lane][(u16)(address + 1)] << 8);
+    machine->registers[sp][lane] += 2;
+    return data;
+}
+
+// the source operand as the scalar handlers read it, in every lane
+__m256i wide_source_data(Wide_Machine *machine, Trace_Event *event, u32 lane_bits) {
+    auto source = &event->source;
+
+    if (source->kind == OPERAND_REGISTER) {
+        auto    reg_ptr = source->register_pointer;
+        __m256i value   = wide_load(machine->registers[reg_ptr->index]);
+        __m256i mask    = _mm256_set1_epi16((s16)reg_ptr->mask);
+
+        // register to register shifts before masking, register to memory masks first
+        if (event->dest.kind == OPERAND_REGISTER)
+            return _mm256_and_si256(wide_shift_right(value, reg_ptr->shift), mask);
+        else
+            return wide_shift_right(_mm256_and_si256(value, mask), reg_ptr->shift);
+    }
+
+    if (source->kind == OPERAND_MEMORY) {
+        alignas(32) u16 data[WIDE_LANES] = {};
+        for (u32 lane = 0; lane < WIDE_LANES; lane += 1) {
+            if (lane_bits & (1 << lane))
+                data[lane] = wide_read_memory(machine, &source->memory_pointer, lane);
+        }
+        return wide_load(data);
+    }
+
+    return _mm256_set1_epi16((s16)source->immediate);
+}
+
+
+// =========================================
+// Execution
+//
+
+// exec_op on every register lane in lane_mask
+void wide_exec_register(Wide_Machine *machine, Decoded_Op op, Register_Pointer *dest_reg_ptr, __m256i data, __m256i lane_mask) {
+    u16    *dest_lanes = machine->registers[dest_reg_ptr->index];
+    __m256i dest       = wide_load(dest_lanes);
+    __m256i mask       = _mm256_set1_epi16((s16)dest_reg_ptr->mask);
+
+    __m256i result = _mm256_and_si256(wide_shift_right(dest, dest_reg_ptr->shift), mask);
+    switch (op) {
+        case OP_MOV: result = data;                           break;
+        case OP_ADD: result = _mm256_add_epi16(result, data); break;
+        case OP_SUB:
+        case OP_CMP: result = _mm256_sub_epi16(result, data); break;
+    }
+    result = _mm256_and_si256(wide_shift_left(result, dest_reg_ptr->shift), mask);
+
+    if (op != OP_CMP) {
+        __m256i written = _mm256_or_si256(_mm256_andnot_si256(mask, dest), result);
+        wide_store(dest_lanes, _mm256_blendv_epi8(dest, written, lane_mask));
+    }
+
+    if (op != OP_MOV) {
+        auto    high_bit = first_bit_set_high(dest_reg_ptr->mask);
+        __m256i flags    = wide_load(machine->flags);
+
+        __m256i zero = _mm256_cmpeq_epi16(result, _mm256_setzero_si256());
+        __m256i zf   = _mm256_and_si256(zero, _mm256_set1_epi16(1 << ZF));
+        __m256i sf   = wide_shift_left(wide_flag(result, (Flags)high_bit), SF);
+
+        __m256i updated = _mm256_andnot_si256(_mm256_set1_epi16((1 << ZF) | (1 << SF)), flags);
+        updated = _mm256_or_si256(updated, _mm256_or_si256(zf, sf));
+        wide_store(machine->flags, _mm256_blendv_epi8(flags, updated, lane_mask));
+    }
+}
+
+// exec_op on the memory of every lane in lane_bits
+void wide_exec_memory(Wide_Machine *machine, Decoded_Op op, Memory_Pointer *dest_mem_ptr, __m256i data, u32 lane_bits) {
+    alignas(32) u16 lane_data[WIDE_LANES];
+    wide_store(lane_data, data);
+
+    u16 dest_mask = (dest_mem_ptr->num_bytes > 1) ? 0xFFFF : 0xFF;
+
+    // exec_op works on flags_register, swap each lane in and out
+    u16 saved_flags = flags_register;
+    for (u32 lane = 0; lane < WIDE_LANES; lane += 1) {
+        if (!(lane_bits & (1 << lane)))  continue;
+
+        u16 address = wide_effective_address(machine, dest_mem_ptr, lane);
+        u8 *dest    = machine->memory[lane] + address;
+
+        flags_register = machine->flags[lane];
+        exec_op(op, (u16 *)dest, 0, dest_mask, lane_data[lane]);
+        machine->flags[lane] = flags_register;
+    }
+    flags_register = saved_flags;
+}
+
+// push, pop, pushf, popf, call and ret for one lane
+// returns: the ip of the lane after the instruction
+u16 wide_stack_lane(Wide_Machine *machine, Trace_Event *event, u32 lane, u16 next_ip) {
+    auto operand = &event->dest;
+
+    if (event->stack == STACK_PUSH) {
+        u16 data = 0;
+        if (event->transfer == TRANSFER_CALL) {
+            data = next_ip;
+            if (operand->kind == OPERAND_RELATIVE)
+                next_ip = (u16)(event->address + operand->immediate);
+            else if (operand->kind == OPERAND_REGISTER)
+                next_ip = machine->registers[operand->register_pointer->index][lane];
+            else
+                next_ip = wide_read_memory(machine, &operand->memory_pointer, lane);
+        }
+        else if (operand->kind == OPERAND_REGISTER) {
+            data = machine->registers[operand->register_pointer->index][lane];
+            if (operand->register_pointer->index == sp)  data -= 2;
+        }
+        else if (operand->kind == OPERAND_MEMORY) {
+            data = wide_read_memory(machine, &operand->memory_pointer, lane);
+        }
+        else {
+            data = flags_to_8086(machine->flags[lane]);
+        }
+
+        wide_push_word(machine, lane, data);
+        return next_ip;
+    }
+
+    // the r/m address does not depend on sp, it is the same before or after the pop
+    u16 data = wide_pop_word(machine, lane);
+    if (event->transfer == TRANSFER_RETURN) {
+        next_ip = data;
+        if (operand->kind == OPERAND_IMMEDIATE_UNSIGNED)
+            machine->registers[sp][lane] += (u16)operand->immediate;
+    }
+    else if (operand->kind == OPERAND_REGISTER) {
+        machine->registers[operand->register_pointer->index][lane] = data;
+    }
+    else if (operand->kind == OPERAND_MEMORY) {
+        u16 address = wide_effective_address(machine, &operand->memory_pointer, lane);
+        machine->memory[lane][address]     = (u8)(data);
+        machine->memory[lane][address + 1] = (u8)(data >> 8);
+    }
+    else {
+        machine->flags[lane] = flags_from_8086(data);
+    }
+
+    return next_ip;
+}
+
+// same conditions as the jcc handler, lanes that take the jump are all ones
+__m256i wide_jump_condition(u8 jump_code, __m256i flags) {
+    __m256i cf = wide_flag(flags, CF);
+    __m256i pf = wide_flag(flags, PF);
+    __m256i zf = wide_flag(flags, ZF);
+    __m256i sf = wide_flag(flags, SF);
+    __m256i of = wide_flag(flags, OF);
+    __m256i sf_xor_of = _mm256_xor_si256(sf, of);
+
+    __m256i condition = _mm256_setzero_si256();
+    bool    negate    = false;
+    switch (jump_code) {
+        case 0b0101: condition = zf; negate = true;                                           break; // jne
+        case 0b0100: condition = zf;                                                          break; // je
+        case 0b1100: condition = _mm256_or_si256(sf, of);                                     break; // jl
+        case 0b1110: condition = _mm256_or_si256(zf, sf_xor_of);                              break; // jle
+        case 0b0010: condition = cf;                                                          break; // jb
+        case 0b0110: condition = _mm256_or_si256(cf, zf);                                     break; // jbe
+        case 0b1010: condition = pf;                                                          break; // jp
+        case 0b0000: condition = of;                                                          break; // jo
+        case 0b1000: condition = sf;                                                          break; // js
+        case 0b1101: condition = sf_xor_of; negate = true;                                    break; // jnl
+        case 0b1111: condition = _mm256_and_si256(zf, sf_xor_of); negate = true;              break; // jg
+        case 0b0011: condition = cf; negate = true;                                           break; // jnb
+        case 0b0111: condition = _mm256_or_si256(cf, zf); negate = true;                      break; // ja
+        case 0b1011: condition = pf; negate = true;                                           break; // jnp
+        case 0b0001: condition = of; negate = true;                                           break; // jno
+        case 0b1001: condition = sf; negate = true;                                           break; // jns
+    }
+
+    __m256i result = _mm256_cmpeq_epi16(condition, _mm256_set1_epi16(1));
+    if (negate)
+        result = _mm256_xor_si256(result, _mm256_set1_epi16(-1));
+    return result;
+}
+
+// returns: the ip of every lane after the instruction
+__m256i wide_execute(Wide_Machine *machine, Wide_Instruction *instruction, __m256i lane_mask, u32 lane_bits) {
+    auto    event = &instruction->event;
+    __m256i next  = _mm256_set1_epi16((s16)(event->address + event->size));
+
+    switch (instruction->action) {
+        case WIDE_SKIP: break;
+
+        case WIDE_OP: {
+            __m256i data = wide_source_data(machine, event, lane_bits);
+            if (event->dest.kind == OPERAND_REGISTER)
+                wide_exec_register(machine, instruction->op, event->dest.register_pointer, data, lane_mask);
+            else
+                wide_exec_memory(machine, instruction->op, &event->dest.memory_pointer, data, lane_bits);
+        } break;
+
+        case WIDE_MOV_IMMEDIATE: {
+            auto    reg_ptr = event->dest.register_pointer;
+            u16     data    = (u16)(((u16)event->source.immediate << reg_ptr->shift) & reg_ptr->mask);
+            u16    *lanes   = machine->registers[reg_ptr->index];
+            __m256i dest    = wide_load(lanes);
+
+            __m256i written = _mm256_andnot_si256(_mm256_set1_epi16((s16)reg_ptr->mask), dest);
+            written = _mm256_or_si256(written, _mm256_set1_epi16((s16)data));
+            wide_store(lanes, _mm256_blendv_epi8(dest, written, lane_mask));
+        } break;
+
+        case WIDE_STACK: {
+            alignas(32) u16 lane_next[WIDE_LANES];
+            wide_store(lane_next, next);
+            for (u32 lane = 0; lane < WIDE_LANES; lane += 1) {
+                if (lane_bits & (1 << lane))
+                    lane_next[lane] = wide_stack_lane(machine, event, lane, lane_next[lane]);
+            }
+            next = wide_load(lane_next);
+        } break;
+
+        case WIDE_JUMP: {
+            __m256i taken  = wide_jump_condition(event->instruction & 0b1111, wide_load(machine->flags));
+            __m256i target = _mm256_set1_epi16((s16)(event->address + event->dest.immediate));
+            next = _mm256_blendv_epi8(next, target, taken);
+        } break;
+    }
+
+    return next;
+}
+
+// runs lanes [0, lane_count) until every ip is past the end of the image
+void wide_run_batch(Wide_Machine *machine, u32 first_instance, u32 lane_count) {
+    u16 image_size = (u16)(instruction_end - instruction_start);
+
+    memset(machine->registers, 0, sizeof(machine->registers));
+    memset(machine->flags,     0, sizeof(machine->flags));
+    memset(machine->memory,    0, sizeof(machine->memory));
+    for (u32 lane = 0; lane < WIDE_LANES; lane += 1) {
+        for (u32 reg = 0; reg < ip; reg += 1)
+            machine->registers[reg][lane] = wide_initial_value((Register_Index)reg, first_instance + lane);
+
+        // unused lanes start finished
+        if (lane >= lane_count)
+            machine->registers[ip][lane] = image_size;
+    }
+
+    __m256i all_ones = _mm256_set1_epi16(-1);
+    __m256i last_ip  = _mm256_set1_epi16((s16)(image_size - 1));
+    for (;;) {
+        __m256i ips = wide_load(machine->registers[ip]);
+
+        // finished lanes sort last
+        __m256i running = _mm256_cmpeq_epi16(_mm256_min_epu16(ips, last_ip), ips);
+        __m256i keys    = _mm256_or_si256(ips, _mm256_andnot_si256(running, all_ones));
+
+        u32 low  = _mm_cvtsi128_si32(_mm_minpos_epu16(_mm256_castsi256_si128(keys)))      & 0xFFFF;
+        u32 high = _mm_cvtsi128_si32(_mm_minpos_epu16(_mm256_extracti128_si256(keys, 1))) & 0xFFFF;
+        u32 lowest = (low < high) ? low : high;
+        if (lowest == 0xFFFF)  break;
+
+        __m256i lane_mask = _mm256_cmpeq_epi16(keys, _mm256_set1_epi16((s16)lowest));
+        __m128i packed    = _mm_packs_epi16(_mm256_castsi256_si128(lane_mask), _mm256_extracti128_si256(lane_mask, 1));
+        u32     lane_bits = (u32)_mm_movemask_epi8(packed);
+
+        Wide_Instruction *instruction = wide_fetch((u16)lowest);
+        __m256i next = wide_execute(machine, instruction, lane_mask, lane_bits);
+        wide_store(machine->registers[ip], _mm256_blendv_epi8(ips, next, lane_mask));
+
+        wide_stats.steps             += 1;
+        wide_stats.lane_instructions += __popcnt(lane_bits);
+    }
+}
+
+
+// =========================================
+// Sweep
+//
+void wide_print_instance(u32 instance, u16 *instance_registers, u16 flags) {
+    char flags_str[FLAGS_COUNT + 1] = {};
+    fill_flags_string(flags, flags_str);
+
+    printf("; %6u  ax:0x%04x bx:0x%04x cx:0x%04x dx:0x%04x sp:0x%04x bp:0x%04x si:0x%04x di:0x%04x ip:0x%04x flags:%s\n",
+           instance,
+           instance_registers[ax], instance_registers[bx], instance_registers[cx], instance_registers[dx],
+           instance_registers[sp], instance_registers[bp], instance_registers[si], instance_registers[di],
+           instance_registers[ip], flags_str);
+}
+
+// one instance at a time on the scalar state, for comparison and for machines without AVX2
+void sweep_scalar(u32 instance_count, bool print_instances) {
+    for (u32 instance = 0; instance < instance_count; instance += 1) {
+        memset(memory, 0, sizeof(memory));
+        for (u32 reg = 0; reg < ip; reg += 1)
+            registers[reg] = wide_initial_value((Register_Index)reg, instance);
+        registers[ip]       = 0;
+        flags_register      = 0;
+        instruction_pointer = instruction_start;
+
+        while (instruction_pointer < instruction_end) {
+            Trace_Event event = {};
+            execute_instruction(&event);
+            wide_stats.steps += 1;
+        }
+
+        if (print_instances)
+            wide_print_instance(instance, registers, flags_register);
+    }
+    wide_stats.lane_instructions = wide_stats.steps;
+}
+
+void sweep_wide(u32 instance_count, bool print_instances) {
+    Wide_Machine *machine = &wide_machine;
+    for (u32 first = 0; first < instance_count; first += WIDE_LANES) {
+        u32 lane_count = instance_count - first;
+        if (lane_count > WIDE_LANES)
+            lane_count = WIDE_LANES;
+
+        wide_run_batch(machine, first, lane_count);
+
+        if (!print_instances)  continue;
+        for (u32 lane = 0; lane < lane_count; lane += 1) {
+            u16 instance_registers[REGISTER_COUNT];
+            for (u32 reg = 0; reg < REGISTER_COUNT; reg += 1)
+                instance_registers[reg] = machine->registers[reg][lane];
+            wide_print_instance(first + lane, instance_registers, machine->flags[lane]);
+        }
+    }
+}
+
+// returns: process exit code
+int run_sweep(u32 instance_count, bool force_scalar, bool print_instances) {
+    if ((instruction_end - instruction_start) >= 0xFFFF) {
+        printf("ERROR: the image does not fit in the 64k address space.\n");
+        return 1;
+    }
+
+    bool use_wide = !force_scalar && cpu_has_avx2();
+    if (!force_scalar && !use_wide)
+        printf("; AVX2 is not available, running the sweep one instance at a time\n");
+
+    // an empty image has no last ip for wide_run_batch to stop at: nothing runs,
+    // every instance ends in its initial state, and the scalar loop reports just that
+    if (instruction_end == instruction_start)
+        use_wide = false;
+
+    if (print_instances)
+        printf("; instance  final registers\n");
+
+    wide_stats = {};
+    if (use_wide) sweep_wide(instance_count, print_instances);
+    else          sweep_scalar(instance_count, print_instances);
+
+    printf("\n; Sweep: %u instances, %s\n", instance_count, use_wide ? "16 lanes" : "scalar");
+    printf(";   instructions: %llu dispatched, %llu executed over all instances\n", wide_stats.steps, wide_stats.lane_instructions);
+    if (use_wide && wide_stats.steps)
+        printf(";   lane occupancy: %.1f%%\n", 100.0 * (f64)wide_stats.lane_instructions / (f64)(wide_stats.steps * WIDE_LANES));
+
+    return 0;
+}
@@ -0,0 +1,753 @@
+// workload_generator.cpp
+//
+// Emits raw 8086 binaries made only of encodings sim8086 decodes and executes,
+// so we can produce reproducible workloads of any dynamic length for scaling
+// measurements. Same spirit as part2/generator.jai: a name, a seed, a count.
+//
+// Layout of the generated program:
+//
+//     mov si, 0                     ; memory walk pointer
+//     mov dx, <seed>                ; weyl sequence used by unpredictable branches
+//     mov word [counter_0], n_0
+//   L0:
+//     mov word [counter_1], n_1     ; one of these per nesting level
+//   L1:
+//     <body>                        ; random mix of mov/add/sub/cmp + branch groups
+//     add si, STRIDE                ; walk the memory footprint
+//     cmp si, limit
+//     jne +3
+//     mov si, 0
+//     sub word [counter_1], 1
+//     jne L1
+//     sub word [counter_0], 1
+//     jne L0
+//
+// Every jump is a short jump (rel8), so the body has a byte budget that shrinks
+// with the nesting depth.
+
+#include "types.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <cstring>
+
+#if SIM86_DEBUG
+#define assert(x) if (!(x)) { __debugbreak(); }
+#else
+#define assert(x)
+#endif
+
+#define arr_len(arr) (sizeof(arr)/sizeof((arr)[0]))
+
+// =========================================
+// Random
+//
+static u64 random_state;
+
+void random_seed(u64 seed) {
+    random_state = seed;
+}
+
+// splitmix64, so that seed 0 is as good as any other
+u64 random_get() {
+    random_state += 0x9E3779B97F4A7C15ull;
+    u64 z = random_state;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+}
+
+// [min, max]
+u32 random_get_within_range(u32 min, u32 max) {
+    return min + (u32)(random_get() % ((u64)max - min + 1));
+}
+
+bool random_chance(u32 percentage) {
+    return random_get_within_range(0, 99) < percentage;
+}
+
+
+// =========================================
+// Encoding
+//
+#define MAX_PROGRAM_SIZE   0x10000
+#define MAX_INSTRUCTION_SIZE     6
+
+#define MAX_DEPTH           4
+// sim8086 keeps displacements as s16, so everything stays below 0x8000
+#define MAX_FOOTPRINT  0x7000
+#define COUNTER_BASE   0x7F00   // loop counters live above the footprint
+#define WALK_STRIDE        64
+#define WALK_WINDOW       256   // displacements are picked within [si, si + WALK_WINDOW)
+
+#define SHORT_JUMP_RANGE  128
+
+#define LOOP_SETUP_SIZE     6   // mov word [counter], imm16
+#define LOOP_TAIL_SIZE      7   // sub word [counter], 1 ; jne
+#define WALK_TAIL_SIZE     12   // add si, imm8 ; cmp si, imm16 ; jne +3 ; mov si, imm16
+
+// sim8086's register encoding (REG/R_M field)
+enum Reg_Code {
+    REG_AX_AL = 0b000,
+    REG_CX_CL = 0b001,
+    REG_DX_DL = 0b010,
+    REG_BX_BL = 0b011,
+    REG_SP_AH = 0b100,
+    REG_BP_CH = 0b101,
+    REG_SI_DH = 0b110,
+    REG_DI_BH = 0b111,
+};
+
+// dx is the weyl sequence, si the walk pointer, sp/bp are left alone
+static u8 scratch_word_regs[] = { REG_AX_AL, REG_CX_CL, REG_BX_BL, REG_DI_BH, };
+static u8 scratch_byte_regs[] = { REG_AX_AL, REG_CX_CL, REG_BX_BL, REG_SP_AH, REG_BP_CH, REG_DI_BH, };
+
+#define R_M_SI 0b100
+
+enum Gen_Op {
+    GEN_MOV,
+    GEN_ADD,
+    GEN_SUB,
+    GEN_CMP,
+
+    GEN_OP_COUNT,
+};
+
+                                          //  mov   add   sub   cmp
+static u8 reg_rm_opcodes[GEN_OP_COUNT]     = { 0x88, 0x00, 0x28, 0x38, };
+static u8 immediate_op_codes[GEN_OP_COUNT] = { 0b000, 0b000, 0b101, 0b111, }; // REG field of 0x80..0x83 / 0xC6..0xC7
+
+struct Code_Buffer {
+    u8  data[MAX_PROGRAM_SIZE];
+    u32 size;
+};
+
+struct Instruction_Bytes {
+    u8 data[MAX_INSTRUCTION_SIZE];
+    u8 size;
+};
+
+inline void put_u8(Instruction_Bytes *bytes, u8 value) {
+    bytes->data[bytes->size] = value;
+    bytes->size += 1;
+}
+
+inline void put_u16(Instruction_Bytes *bytes, u16 value) {
+    put_u8(bytes, (u8)(value & 0xFF));
+    put_u8(bytes, (u8)(value >> 8));
+}
+
+inline u8 mod_reg_rm(u8 mod, u8 reg, u8 r_m) {
+    return (u8)((mod << 6) | (reg << 3) | r_m);
+}
+
+void emit(Code_Buffer *code, Instruction_Bytes *bytes) {
+    if (code->size + bytes->size > MAX_PROGRAM_SIZE) {
+        printf("Error: generated program exceeds %d bytes\n", MAX_PROGRAM_SIZE);
+        exit(1);
+    }
+
+    memcpy(code->data + code->size, bytes->data, bytes->size);
+    code->size += bytes->size;
+}
+
+// [si + disp], picking the shortest displacement that fits
+void put_si_memory_operand(Instruction_Bytes *bytes, u8 reg, u16 disp) {
+    if (disp <= 127) {
+        put_u8(bytes, mod_reg_rm(0b01, reg, R_M_SI));
+        put_u8(bytes, (u8)disp);
+    } else {
+        put_u8(bytes, mod_reg_rm(0b10, reg, R_M_SI));
+        put_u16(bytes, disp);
+    }
+}
+
+Instruction_Bytes encode_mov_word_direct_immediate(u16 address, u16 data) {
+    Instruction_Bytes result = {};
+    put_u8 (&result, 0xC7);
+    put_u8 (&result, mod_reg_rm(0b00, 0b000, 0b110));
+    put_u16(&result, address);
+    put_u16(&result, data);
+    return result;
+}
+
+Instruction_Bytes encode_sub_word_direct_1(u16 address) {
+    Instruction_Bytes result = {};
+    put_u8 (&result, 0x83);
+    put_u8 (&result, mod_reg_rm(0b00, 0b101, 0b110));
+    put_u16(&result, address);
+    put_u8 (&result, 1);
+    return result;
+}
+
+Instruction_Bytes encode_mov_reg_immediate16(u8 reg, u16 data) {
+    Instruction_Bytes result = {};
+    put_u8 (&result, (u8)(0xB8 | reg));
+    put_u16(&result, data);
+    return result;
+}
+
+Instruction_Bytes encode_jump(u8 jump_code, s8 ip_inc8) {
+    Instruction_Bytes result = {};
+    put_u8(&result, (u8)(0x70 | jump_code));
+    put_u8(&result, (u8)ip_inc8);
+    return result;
+}
+
+#define JUMP_CODE_JE  0b0100
+#define JUMP_CODE_JNE 0b0101
+#define JUMP_CODE_JS  0b1000
+
+
+// =========================================
+// Workload
+//
+struct Arguments {
+    char *name;
+    u64   seed;
+    u64   count;       // target dynamic instruction count
+    u32   depth;       // loop nesting depth
+    u32   body;        // instructions per innermost loop body
+    u32   footprint;   // bytes of memory touched
+    u32   weights[GEN_OP_COUNT];
+    u32   memory;      // % of body instructions with a memory operand
+    u32   immediate;   // % of body instructions with an immediate source
+    u32   branches;    // % of body slots that become a branch group
+    u32   predictable; // % of branch groups whose outcome never changes
+};
+
+struct Body_Stats {
+    u32 instructions;        // static count, branch groups included
+    u32 bytes;
+    u32 memory_operands;
+    u32 predictable_branches;
+    u32 unpredictable_branches;
+    u32 op_counts[GEN_OP_COUNT];
+};
+
+struct Walk {
+    u16 stride;  // 0 means si never moves
+    u16 limit;
+    u16 window;
+};
+
+Gen_Op random_op(Arguments *args) {
+    u32 total = 0;
+    for (int it = 0; it < GEN_OP_COUNT; it += 1)  total += args->weights[it];
+
+    u32 pick = random_get_within_range(0, total - 1);
+    for (int it = 0; it < GEN_OP_COUNT; it += 1) {
+        if (pick < args->weights[it])  return (Gen_Op)it;
+        pick -= args->weights[it];
+    }
+
+    return GEN_MOV;
+}
+
+Instruction_Bytes random_instruction(Arguments *args, Walk *walk, Body_Stats *stats) {
+    Instruction_Bytes result = {};
+
+    Gen_Op op = random_op(args);
+    u8     w  = random_chance(75) ? 1 : 0;
+    u8     reg;
+    if (w) reg = scratch_word_regs[random_get_within_range(0, arr_len(scratch_word_regs) - 1)];
+    else   reg = scratch_byte_regs[random_get_within_range(0, arr_len(scratch_byte_regs) - 1)];
+
+    bool is_memory = random_chance(args->memory);
+    u16  disp      = 0;
+    if (is_memory)
+        disp = (u16)random_get_within_range(0, walk->window - 2);
+
+    if (random_chance(args->immediate)) {
+        u16 data = (u16)random_get();
+        if (!w)  data &= 0xFF;
+
+        if (op == GEN_MOV) {
+            if (is_memory) {
+                put_u8(&result, (u8)(0xC6 | w));
+                put_si_memory_operand(&result, 0b000, disp);
+            } else {
+                put_u8(&result, (u8)(0xB0 | (w << 3) | reg));
+            }
+            if (w) put_u16(&result, data);
+            else   put_u8 (&result, (u8)data);
+        } else {
+            // 0x83 sign-extends an imm8, use it whenever the value allows
+            bool short_data = w && (((s16)data >= -128) && ((s16)data <= 127));
+            if (w && random_chance(50)) {
+                data       = (u16)(s16)(s8)data;
+                short_data = true;
+            }
+
+            u8 s = short_data ? 1 : 0;
+            put_u8(&result, (u8)(0x80 | (s << 1) | w));
+            if (is_memory) put_si_memory_operand(&result, immediate_op_codes[op], disp);
+            else           put_u8(&result, mod_reg_rm(0b11, immediate_op_codes[op], reg));
+
+            if (w && !s) put_u16(&result, data);
+            else         put_u8 (&result, (u8)data);
+        }
+    } else {
+        u8 d = random_chance(50) ? 1 : 0;
+        put_u8(&result, (u8)(reg_rm_opcodes[op] | (d << 1) | w));
+
+        if (is_memory) {
+            put_si_memory_operand(&result, reg, disp);
+        } else {
+            u8 r_m;
+            if (w) r_m = scratch_word_regs[random_get_within_range(0, arr_len(scratch_word_regs) - 1)];
+            else   r_m = scratch_byte_regs[random_get_within_range(0, arr_len(scratch_byte_regs) - 1)];
+            put_u8(&result, mod_reg_rm(0b11, reg, r_m));
+        }
+    }
+
+    stats->memory_operands += is_memory;
+    stats->op_counts[op]   += 1;
+    return result;
+}
+
+// Fills the innermost loop body within byte_budget. Returns the expected number
+// of dynamic instructions per pass through the body.
+f64 generate_body(Code_Buffer *code, Arguments *args, Walk *walk, u32 byte_budget, Body_Stats *stats) {
+    f64 dynamic_count = 0;
+
+    u32 body_start = code->size;
+    while (stats->instructions < args->body) {
+        u32 used = code->size - body_start;
+
+        // a branch group that would overshoot the instruction count becomes a plain instruction
+        bool branch_group = random_chance(args->branches) && (stats->instructions + 3 <= args->body);
+        if (branch_group) {
+            // branch group: flag setter, jcc over the payload, payload
+            Instruction_Bytes setter = {};
+            u8                jump_code;
+            bool predictable = random_chance(args->predictable);
+            if (predictable) {
+                put_u8(&setter, 0x39);                                     // cmp dx, dx: ZF is always set
+                put_u8(&setter, mod_reg_rm(0b11, REG_DX_DL, REG_DX_DL));
+                jump_code = JUMP_CODE_JNE;                                 // never taken
+            } else {
+                put_u8 (&setter, 0x81);                                    // add dx, 0x9E37: sign of a weyl sequence
+                put_u8 (&setter, mod_reg_rm(0b11, 0b000, REG_DX_DL));
+                put_u16(&setter, 0x9E37);
+                jump_code = JUMP_CODE_JS;                                  // taken about half the time
+            }
+
+            Body_Stats payload_stats = {};
+            Instruction_Bytes payload = random_instruction(args, walk, &payload_stats);
+            Instruction_Bytes jump    = encode_jump(jump_code, (s8)payload.size);
+
+            if (used + setter.size + jump.size + payload.size > byte_budget)  break;
+
+            emit(code, &setter);
+            emit(code, &jump);
+            emit(code, &payload);
+
+            stats->instructions    += 3;
+            stats->memory_operands += payload_stats.memory_operands;
+            for (int it = 0; it < GEN_OP_COUNT; it += 1)  stats->op_counts[it] += payload_stats.op_counts[it];
+
+            if (predictable) {
+                stats->predictable_branches += 1;
+                dynamic_count += 3;
+            } else {
+                stats->unpredictable_branches += 1;
+                dynamic_count += 2.5;
+            }
+        } else {
+            Body_Stats instruction_stats = {};
+            Instruction_Bytes instruction = random_instruction(args, walk, &instruction_stats);
+            if (used + instruction.size > byte_budget)  break;
+
+            emit(code, &instruction);
+
+            stats->instructions    += 1;
+            stats->memory_operands += instruction_stats.memory_operands;
+            for (int it = 0; it < GEN_OP_COUNT; it += 1)  stats->op_counts[it] += instruction_stats.op_counts[it];
+
+            dynamic_count += 1;
+        }
+    }
+
+    stats->bytes = code->size - body_start;
+    return dynamic_count;
+}
+
+void generate_walk_tail(Code_Buffer *code, Walk *walk) {
+    if (!walk->stride)  return;
+
+    Instruction_Bytes add_si = {};
+    put_u8(&add_si, 0x83);
+    put_u8(&add_si, mod_reg_rm(0b11, 0b000, REG_SI_DH));
+    put_u8(&add_si, (u8)walk->stride);
+
+    Instruction_Bytes cmp_si = {};
+    put_u8 (&cmp_si, 0x81);
+    put_u8 (&cmp_si, mod_reg_rm(0b11, 0b111, REG_SI_DH));
+    put_u16(&cmp_si, walk->limit);
+
+    Instruction_Bytes reset_si = encode_mov_reg_immediate16(REG_SI_DH, 0);
+    Instruction_Bytes jne      = encode_jump(JUMP_CODE_JNE, (s8)reset_si.size);
+
+    emit(code, &add_si);
+    emit(code, &cmp_si);
+    emit(code, &jne);
+    emit(code, &reset_si);
+}
+
+void generate_loop(Code_Buffer *code, Arguments *args, Walk *walk, u16 *counts, u32 level, u32 body_budget, Body_Stats *stats, f64 *body_dynamic_count) {
+    u16 counter_address = (u16)(COUNTER_BASE + 2*level);
+
+    Instruction_Bytes setup = encode_mov_word_direct_immediate(counter_address, counts[level]);
+    emit(code, &setup);
+
+    u32 loop_start = code->size;
+    if (level + 1 < args->depth) {
+        generate_loop(code, args, walk, counts, level + 1, body_budget, stats, body_dynamic_count);
+    } else {
+        *body_dynamic_count = generate_body(code, args, walk, body_budget, stats);
+        generate_walk_tail(code, walk);
+    }
+
+    Instruction_Bytes sub = encode_sub_word_direct_1(counter_address);
+    emit(code, &sub);
+
+    s32 ip_inc = (s32)loop_start - (s32)(code->size + 2);
+    assert(ip_inc >= -SHORT_JUMP_RANGE);
+    Instruction_Bytes jne = encode_jump(JUMP_CODE_JNE, (s8)ip_inc);
+    emit(code, &jne);
+}
+
+// dynamic instructions executed by the whole program for the given loop counts
+f64 dynamic_instruction_count(u32 depth, u16 *counts, f64 body_dynamic_count, Walk *walk) {
+    f64 inner = body_dynamic_count;
+    if (walk->stride) {
+        f64 resets_per_pass = (f64)walk->stride / (f64)walk->limit;
+        inner += 3 + resets_per_pass;
+    }
+
+    for (s32 level = (s32)depth - 1; level >= 0; level -= 1) {
+        inner = (f64)counts[level] * (inner + 2) + 1; // + sub/jne per pass, + mov to set up the counter
+    }
+
+    return inner + 2; // prologue
+}
+
+// lowers counts[level] to the smallest value that still reaches the target, the
+// other levels as they are; counts must reach the target on entry
+void shrink_level_count(u32 level, u32 depth, u16 *counts, f64 body_dynamic_count, Walk *walk, u64 target) {
+    u32 low  = 1;
+    u32 high = counts[level];
+    while (low < high) {
+        u32 mid = (low + high) / 2;
+        counts[level] = (u16)mid;
+
+        if (dynamic_instruction_count(depth, counts, body_dynamic_count, walk) < (f64)target)
+            low  = mid + 1;
+        else
+            high = mid;
+    }
+    counts[level] = (u16)low;
+}
+
+#define COUNT_SEARCH_WINDOW 64 // outer counts tried below the uniform count, per level
+
+struct Count_Search {
+    u32  depth;
+    u64  target;
+    f64  body_dynamic_count;
+    Walk *walk;
+    u16  uniform;               // smallest count reaching the target on every level
+
+    u16  counts[MAX_DEPTH];
+    u16  best_counts[MAX_DEPTH];
+    f64  best_count;
+};
+
+// every combination of outer counts within the window, the innermost level takes
+// the smallest count that reaches the target; keeps the one closest to the target
+void search_counts(Count_Search *search, u32 level) {
+    if (level + 1 == search->depth) {
+        search->counts[level] = 0xFFFF;
+        if (dynamic_instruction_count(search->depth, search->counts, search->body_dynamic_count, search->walk) < (f64)search->target)
+            return;
+
+        shrink_level_count(level, search->depth, search->counts, search->body_dynamic_count, search->walk, search->target);
+        f64 count = dynamic_instruction_count(search->depth, search->counts, search->body_dynamic_count, search->walk);
+        if (count < search->best_count) {
+            search->best_count = count;
+            memcpy(search->best_counts, search->counts, sizeof(search->counts));
+        }
+        return;
+    }
+
+    // the loops stay roughly balanced: no outer count below half the uniform one,
+    // and outer loops loop unless the target is too small for the nesting
+    u32 lowest = search->uniform / 2;
+    if (search->uniform > COUNT_SEARCH_WINDOW && lowest < (u32)search->uniform - COUNT_SEARCH_WINDOW + 1)
+        lowest = search->uniform - COUNT_SEARCH_WINDOW + 1;
+    if (lowest < 2)
+        lowest = (search->uniform <= 2) ? 1 : 2;
+
+    for (u32 count = search->uniform; count >= lowest; count -= 1) {
+        search->counts[level] = (u16)count;
+        search_counts(search, level + 1);
+    }
+}
+
+bool parse_u64(char *str, u64 *out) {
+    char *end = 0;
+    *out = strtoull(str, &end, 0);
+    return end && (end != str) && (*end == 0);
+}
+
+void print_usage(char *exe) {
+    printf("Usage: %s -name <name> [options]\n", exe);
+    printf("    -seed, -s  <n>     random seed                                  (default 0)\n");
+    printf("    -count, -c <n>     target dynamic instruction count             (default 1000)\n");
+    printf("    -depth     <n>     loop nesting depth, 1..%d                     (default 2)\n", MAX_DEPTH);
+    printf("    -body      <n>     instructions in the innermost loop body      (default 12)\n");
+    printf("    -footprint <n>     bytes of memory touched, up to 0x%X       (default 4096)\n", MAX_FOOTPRINT);
+    printf("    -mov -add -sub -cmp <n>   instruction mix weights                (default 4 2 2 1)\n");
+    printf("    -memory    <0..100> %% of instructions with a memory operand     (default 25)\n");
+    printf("    -immediate <0..100> %% of instructions with an immediate source  (default 25)\n");
+    printf("    -branches  <0..100> %% of body slots that are branch groups      (default 10)\n");
+    printf("    -predictable <0..100> %% of branch groups with a fixed outcome   (default 50)\n");
+}
+
+bool parse_arguments(int args_count, char *args[], Arguments *result) {
+    result->count       = 1000;
+    result->depth       = 2;
+    result->body        = 12;
+    result->footprint   = 4096;
+    result->weights[GEN_MOV] = 4;
+    result->weights[GEN_ADD] = 2;
+    result->weights[GEN_SUB] = 2;
+    result->weights[GEN_CMP] = 1;
+    result->memory      = 25;
+    result->immediate   = 25;
+    result->branches    = 10;
+    result->predictable = 50;
+
+    for (int it = 1; it < args_count; it += 1) {
+        char *arg = args[it];
+        if (it + 1 >= args_count) {
+            printf("Error: missing value for '%s'\n", arg);
+            return false;
+        }
+        char *value_str = args[it + 1];
+        it += 1;
+
+        if (strcmp(arg, "-name") == 0) {
+            result->name = value_str;
+            continue;
+        }
+
+        u64 value = 0;
+        if (!parse_u64(value_str, &value)) {
+            printf("Error: '%s' is not a number (for '%s')\n", value_str, arg);
+            return false;
+        }
+
+             if (!strcmp(arg, "-seed")  || !strcmp(arg, "-s")) result->seed  = value;
+        else if (!strcmp(arg, "-count") || !strcmp(arg, "-c")) result->count = value;
+        else if (!strcmp(arg, "-depth"))       result->depth       = (u32)value;
+        else if (!strcmp(arg, "-body"))        result->body        = (u32)value;
+        else if (!strcmp(arg, "-footprint"))   result->footprint   = (u32)value;
+        else if (!strcmp(arg, "-mov"))         result->weights[GEN_MOV] = (u32)value;
+        else if (!strcmp(arg, "-add"))         result->weights[GEN_ADD] = (u32)value;
+        else if (!strcmp(arg, "-sub"))         result->weights[GEN_SUB] = (u32)value;
+        else if (!strcmp(arg, "-cmp"))         result->weights[GEN_CMP] = (u32)value;
+        else if (!strcmp(arg, "-memory"))      result->memory      = (u32)value;
+        else if (!strcmp(arg, "-immediate"))   result->immediate   = (u32)value;
+        else if (!strcmp(arg, "-branches"))    result->branches    = (u32)value;
+        else if (!strcmp(arg, "-predictable")) result->predictable = (u32)value;
+        else {
+            printf("Error: unknown argument '%s'\n", arg);
+            return false;
+        }
+    }
+
+    if (!result->name) {
+        printf("Error: Must give a name\n");
+        return false;
+    }
+    if ((result->depth < 1) || (result->depth > MAX_DEPTH)) {
+        printf("Error: depth must be within 1..%d\n", MAX_DEPTH);
+        return false;
+    }
+    if ((result->footprint < 2) || (result->footprint > MAX_FOOTPRINT)) {
+        printf("Error: footprint must be within 2..0x%X\n", MAX_FOOTPRINT);
+        return false;
+    }
+    if (!result->count) {
+        printf("Error: count must be at least one instruction\n");
+        return false;
+    }
+    if (!result->body) {
+        printf("Error: body must contain at least one instruction\n");
+        return false;
+    }
+
+    u32 weight_sum = 0;
+    for (int it = 0; it < GEN_OP_COUNT; it += 1)  weight_sum += result->weights[it];
+    if (!weight_sum) {
+        printf("Error: at least one of -mov/-add/-sub/-cmp must have a non-zero weight\n");
+        return false;
+    }
+
+    if (result->memory      > 100)  result->memory      = 100;
+    if (result->immediate   > 100)  result->immediate   = 100;
+    if (result->branches    > 100)  result->branches    = 100;
+    if (result->predictable > 100)  result->predictable = 100;
+
+    return true;
+}
+
+int main(int args_count, char *args[])
+{
+    Arguments args_parsed = {};
+    if (!parse_arguments(args_count, args, &args_parsed)) {
+        print_usage(args[0]);
+        return 1;
+    }
+    Arguments *arguments = &args_parsed;
+
+    random_seed(arguments->seed);
+
+    Walk walk = {};
+    walk.window = (u16)((arguments->footprint < WALK_WINDOW) ? arguments->footprint : WALK_WINDOW);
+    if (arguments->footprint >= (u32)walk.window + WALK_STRIDE) {
+        walk.stride = WALK_STRIDE;
+        walk.limit  = (u16)(((arguments->footprint - walk.window) / WALK_STRIDE) * WALK_STRIDE + WALK_STRIDE);
+    }
+
+    s32 body_budget = SHORT_JUMP_RANGE - LOOP_TAIL_SIZE - (s32)(arguments->depth - 1)*(LOOP_SETUP_SIZE + LOOP_TAIL_SIZE);
+    if (walk.stride)
+        body_budget -= WALK_TAIL_SIZE;
+
+    // the loop counts only change immediates, so the body can be generated once
+    // and the counts patched in afterwards
+    static Code_Buffer code;
+    Body_Stats stats              = {};
+    f64        body_dynamic_count = 0;
+    u16        counts[MAX_DEPTH]  = {};
+    for (u32 it = 0; it < arguments->depth; it += 1)  counts[it] = 1;
+
+    Instruction_Bytes init_si = encode_mov_reg_immediate16(REG_SI_DH, 0);
+    Instruction_Bytes init_dx = encode_mov_reg_immediate16(REG_DX_DL, (u16)random_get());
+    emit(&code, &init_si);
+    emit(&code, &init_dx);
+
+    u32 loops_start = code.size;
+    generate_loop(&code, arguments, &walk, counts, 0, (u32)body_budget, &stats, &body_dynamic_count);
+
+    // smallest uniform count reaching the target (counters are 16 bits, 0 would mean 65536)
+    u32 low  = 1;
+    u32 high = 0xFFFF;
+    for (u32 it = 0; it < arguments->depth; it += 1)  counts[it] = (u16)high;
+    if (dynamic_instruction_count(arguments->depth, counts, body_dynamic_count, &walk) < (f64)arguments->count) {
+        printf("Error: %llu dynamic instructions cannot be reached with depth %u, try a larger -depth or -body\n",
+               arguments->count, arguments->depth);
+        return 1;
+    }
+    while (low < high) {
+        u32 mid = (low + high) / 2;
+        for (u32 it = 0; it < arguments->depth; it += 1)  counts[it] = (u16)mid;
+
+        if (dynamic_instruction_count(arguments->depth, counts, body_dynamic_count, &walk) < (f64)arguments->count)
+            low  = mid + 1;
+        else
+            high = mid;
+    }
+    for (u32 it = 0; it < arguments->depth; it += 1)  counts[it] = (u16)low;
+
+    // a step of any one count moves the total by a whole pass of its loop, so the
+    // uniform count can overshoot by a lot: search the counts level by level
+    {
+        Count_Search search = {};
+        search.depth              = arguments->depth;
+        search.target             = arguments->count;
+        search.body_dynamic_count = body_dynamic_count;
+        search.walk               = &walk;
+        search.uniform            = (u16)low;
+        search.best_count         = dynamic_instruction_count(arguments->depth, counts, body_dynamic_count, &walk);
+        memcpy(search.best_counts, counts, sizeof(search.best_counts));
+
+        search_counts(&search, 0);
+        memcpy(counts, search.best_counts, sizeof(search.best_counts));
+    }
+
+    // patch the counter setups: each level starts with mov word [counter], imm16
+    {
+        u32 cursor = loops_start;
+        for (u32 level = 0; level < arguments->depth; level += 1) {
+            assert(code.data[cursor] == 0xC7);
+            code.data[cursor + 4] = (u8)(counts[level] & 0xFF);
+            code.data[cursor + 5] = (u8)(counts[level] >> 8);
+            cursor += LOOP_SETUP_SIZE;
+        }
+    }
+
+    f64 expected_count = dynamic_instruction_count(arguments->depth, counts, body_dynamic_count, &walk);
+    f64 count_error    = 100.0 * (expected_count - (f64)arguments->count) / (f64)arguments->count;
+
+    if (stats.instructions < arguments->body)
+        printf("Warning: the body has %u of the %u requested instructions, the short jumps closing the loops leave it %d bytes at depth %u\n",
+               stats.instructions, arguments->body, body_budget, arguments->depth);
+
+    char bin_name [256] = {};
+    char info_name[256] = {};
+    sprintf_s(bin_name,  arr_len(bin_name),  "workload_%s.bin", arguments->name);
+    sprintf_s(info_name, arr_len(info_name), "info_%s.txt",     arguments->name);
+
+    FILE *bin_file = 0;
+    if (fopen_s(&bin_file, bin_name, "wb"))
+    {
+        printf("ERROR: File '%s' could not be opened.\n", bin_name);
+        return 1;
+    }
+    fwrite(code.data, sizeof(u8), code.size, bin_file);
+    fclose(bin_file);
+
+    char info[2048] = {};
+    s32  info_len   = sprintf_s(info, arr_len(info),
+        "Random seed: %llu\n"
+        "Loop depth: %u\n"
+        "Loop counts:",
+        arguments->seed, arguments->depth);
+    for (u32 it = 0; it < arguments->depth; it += 1)
+        info_len += sprintf_s(info + info_len, arr_len(info) - info_len, " %u", counts[it]);
+    info_len += sprintf_s(info + info_len, arr_len(info) - info_len,
+        "\n"
+        "Program size: %u bytes\n"
+        "Body: %u instructions (%u requested), %u bytes (%u memory operands)\n"
+        "Body mix: mov %u, add %u, sub %u, cmp %u\n"
+        "Branch groups: %u predictable, %u unpredictable\n"
+        "Memory footprint: %u bytes (stride %u, window %u)\n"
+        "Target dynamic instructions: %llu\n"
+        "Expected dynamic instructions: %.0f (%+.2f%% vs the target)\n",
+        code.size,
+        stats.instructions, arguments->body, stats.bytes, stats.memory_operands,
+        stats.op_counts[GEN_MOV], stats.op_counts[GEN_ADD], stats.op_counts[GEN_SUB], stats.op_counts[GEN_CMP],
+        stats.predictable_branches, stats.unpredictable_branches,
+        walk.stride ? (u32)(walk.limit - walk.stride + walk.window) : (u32)walk.window, walk.stride, walk.window,
+        arguments->count,
+        expected_count, count_error);
+    if (stats.unpredictable_branches)
+        info_len += sprintf_s(info + info_len, arr_len(info) - info_len,
+            "Approximate: unpredictable branches are counted as taken half the time\n");
+
+    printf("%s", info);
+
+    FILE *info_file = 0;
+    if (fopen_s(&info_file, info_name, "wb"))
+    {
+        printf("ERROR: File '%s' could not be opened.\n", info_name);
+        return 1;
+    }
+    fwrite(info, sizeof(char), info_len, info_file);
+    fclose(info_file);
+
+    return 0;
+}